@@ -1,20 +1,49 @@
 #define SEISCOMP_COMPONENT K_Class
 // Valid within 0-10 degrees from 0 to 80 km;
-#define DELTA_MIN 0.
-#define DELTA_MAX 10
-#define DEPTH_MAX 80
+#define DELTA_MIN KClass::DeltaMin
+#define DELTA_MAX KClass::DeltaMax
+#define DEPTH_MAX KClass::DepthMax
 #define MAG_TYPE "K_Class"
+#define PRELIMINARY_COMMENT "K_Class.preliminary"
 
 #include "K-Class.h"
-
+#include "absmax.h"
+#include "amplitude.h"
+#include "calibration.h"
+#include "channelmap.h"
+#include "magnitude.h"
+#include "profiles.h"
+#include "published.h"
+#include "regionpool.h"
+#include "regions.h"
+#include "reload.h"
+#include "stats.h"
+#include "taskpool.h"
+#include "ttcache.h"
+#include "ttgrid.h"
+#include "ttlayered.h"
+#include "ttpool.h"
+#include "wafilter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
-#include <boost/bind/bind.hpp>
-
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <seiscomp/datamodel/amplitude.h>
+#include <seiscomp/datamodel/comment.h>
 #include <seiscomp/logging/log.h>
 #include <seiscomp/math/geo.h>
 #include <seiscomp/processing/amplitudes/ML.h>
 #include <seiscomp/processing/magnitudeprocessor.h>
 #include <seiscomp/seismology/ttt.h>
+#include <seiscomp/utils/keyvalues.h>
 #include <seiscomp/client/application.h>
 
 using namespace std;
@@ -31,16 +60,20 @@ summ (
 	const Processing::AmplitudeProcessor::AmplitudeValue &v0,
 	const Processing::AmplitudeProcessor::AmplitudeValue &v1)
 {
-	Processing::AmplitudeProcessor::AmplitudeValue v;
-	v.value = (v0.value + v1.value);
+	KClass::AmplitudeValue k0, k1;
+	k0.value = v0.value;
+	k0.lower = v0.lowerUncertainty ? *v0.lowerUncertainty : 0.0;
+	k0.upper = v0.upperUncertainty ? *v0.upperUncertainty : 0.0;
+	k1.value = v1.value;
+	k1.lower = v1.lowerUncertainty ? *v1.lowerUncertainty : 0.0;
+	k1.upper = v1.upperUncertainty ? *v1.upperUncertainty : 0.0;
 
-	double l0 = v0.lowerUncertainty ? *v0.lowerUncertainty : 0.0;
-	double u0 = v0.upperUncertainty ? *v0.upperUncertainty : 0.0;
-	double l1 = v1.lowerUncertainty ? *v1.lowerUncertainty : 0.0;
-	double u1 = v1.upperUncertainty ? *v1.upperUncertainty : 0.0;
+	KClass::AmplitudeValue k = KClass::summ (k0, k1);
 
-	v.lowerUncertainty = std::sqrt (l0 * l0 + l1 * l1);
-	v.upperUncertainty = std::sqrt (u0 * u0 + u1 * u1);
+	Processing::AmplitudeProcessor::AmplitudeValue v;
+	v.value = k.value;
+	v.lowerUncertainty = k.lower;
+	v.upperUncertainty = k.upper;
 
 	return v;
 }
@@ -53,36 +86,115 @@ average (
 	const Processing::AmplitudeProcessor::AmplitudeTime &t0,
 	const Processing::AmplitudeProcessor::AmplitudeTime &t1)
 {
+	KClass::AmplitudeTime k0, k1;
+	k0.reference = double (t0.reference);
+	k0.begin = t0.begin;
+	k0.end = t0.end;
+	k1.reference = double (t1.reference);
+	k1.begin = t1.begin;
+	k1.end = t1.end;
+
+	KClass::AmplitudeTime k = KClass::average (k0, k1);
+
 	Processing::AmplitudeProcessor::AmplitudeTime t;
-	t.reference = Core::Time ((double (t0.reference) + double (t1.reference)) * 0.5);
+	t.reference = Core::Time (k.reference);
+	t.begin = k.begin;
+	t.end = k.end;
+
+	return t;
+}
+
+// Joins the elements of a list parameter as written in the configuration
+std::string
+joinList (const std::vector<std::string> &list)
+{
+	std::string text;
+	for (const std::string &item : list)
+	{
+		if (!text.empty ())
+		{
+			text += ", ";
+		}
+		text += item;
+	}
+	return text;
+}
 
-	// Compute lower and upper uncertainty
-	Core::Time t0b = t0.reference + Core::TimeSpan (t0.begin);
-	Core::Time t0e = t0.reference + Core::TimeSpan (t0.end);
-	Core::Time t1b = t1.reference + Core::TimeSpan (t1.begin);
-	Core::Time t1e = t1.reference + Core::TimeSpan (t1.end);
+// Computes the earliest P and S from the travel-time table
+bool
+computeFirstArrivals (
+	TravelTimeTableInterface *ttt, double hypoLat, double hypoLon,
+	double hypoDepth, double recvLat, double recvLon, double recvElev,
+	KClass::FirstArrivals &arrivals)
+{
+	TravelTimeList *ttlist =
+		ttt->compute(hypoLat, hypoLon, hypoDepth,
+						recvLat, recvLon, recvElev, 1);
 
-	Core::Time minTime = t.reference;
-	Core::Time maxTime = t.reference;
+	if (!ttlist || ttlist->isEmpty()) {
+		delete ttlist;
+		return false;
+	}
 
-	minTime = std::min (minTime, t0b);
-	minTime = std::min (minTime, t0e);
-	minTime = std::min (minTime, t1b);
-	minTime = std::min (minTime, t1e);
+	// Fetch P and S
+	// Added fix to find "Any" P and S
+	// As P and S are unavailable for events ~<250km
+	const char* pCandidates[] = {"Pg", "Pn", "P"};
+	const char* sCandidates[] = {"Sg", "Sn", "S"};
+
+	const TravelTime *tp = nullptr;
+	const TravelTime *ts = nullptr;
+
+	// Find the earliest P-type phase
+	for (const char* phaseName : pCandidates) {
+		const TravelTime *t = getPhase(ttlist, phaseName);
+		if (t) {
+			// If we haven't found a P yet, or if this one is earlier, keep it
+			if (!tp || t->time < tp->time) {
+				tp = t;
+			}
+		}
+	}
 
-	maxTime = std::max (maxTime, t0b);
-	maxTime = std::max (maxTime, t0e);
-	maxTime = std::max (maxTime, t1b);
-	maxTime = std::max (maxTime, t1e);
+	// Find the earliest S-type phase
+	for (const char* phaseName : sCandidates) {
+		const TravelTime *t = getPhase(ttlist, phaseName);
+		if (t) {
+			// If we haven't found an S yet, or if this one is earlier, keep it
+			if (!ts || t->time < ts->time) {
+				ts = t;
+			}
+		}
+	}
 
-	t.begin = (double)(minTime - t.reference);
-	t.end = (double)(maxTime - t.reference);
+	arrivals.haveP = tp != nullptr;
+	arrivals.haveS = ts != nullptr;
+	arrivals.p = tp ? tp->time : 0.0;
+	arrivals.s = ts ? ts->time : 0.0;
 
-	return t;
+	delete ttlist;
+	return true;
 }
 
 ADD_SC_PLUGIN ("K_Class magnitude", "Dmitry Sidorov-Biryukov", 0, 0, 3)
 
+// Source-receiver geometry and first arrivals of one station for one origin.
+// Computed once per station and shared by the three components.
+struct StationEnvironment
+{
+	// Error code of the coordinate extraction (0 = valid geometry)
+	int geometryError = 0;
+	double distance = 0.0;
+	double depth = 0.0;
+	// Set for stations or sources outside the configured range, for which
+	// no travel times are computed
+	bool distanceOutOfRange = false;
+	bool depthOutOfRange = false;
+	// Error code of the travel-time computation (0 = arrivals computed)
+	int travelTimeError = 0;
+	KClass::FirstArrivals arrivals;
+};
+
 // We need to create a custom non abstract class for individual magnitude
 // computation
 
@@ -94,42 +206,167 @@ class SimpleAmplitudeProcessor
 		: Processing::AbstractAmplitudeProcessor_ML (MAG_TYPE)
 	{
 
-	}
-	void setTravelTimeTable(TravelTimeTableInterfacePtr ttt)
-	{
-        _ttt = ttt;
 	}
 	friend class AmplitudeProcessor_K_Class;
 
   private:
-	bool _haveP;
-	bool _haveS;
-	Core::Time _sArrival;
-	Core::Time _pArrival;
-	TravelTimeTableInterfacePtr _ttt;
+	// First arrivals relative to the origin time
+	KClass::FirstArrivals _arrivals;
+	Core::Time _originTime;
+	// Incremental and reprocessing peak searches of the signal window
+	KClass::PeakSearch _peakSearch;
+	// Fused filter mode: the parent runs the Wood-Anderson simulation of
+	// all components and passes the filtered samples of a record in
+	// _filtered before feeding it
+	KClass::WoodAndersonFilter *_fusedFilter{nullptr};
+	const KClass::WoodAndersonResponse *_waResponse{nullptr};
+	int _fusedLane{0};
+	const double *_filtered{nullptr};
+	size_t _filteredCount{0};
+	// Filter of samples the parent did not pass, e.g. an interpolated gap,
+	// restarted at the first of them
+	KClass::WoodAndersonFilter _gapFilter;
+	bool _inGap{false};
+	// Incremented whenever the processed data changes
+	uint64_t _dataVersion{0};
+
+	// Last peak search, reused while the data and the searched range are
+	// unchanged, e.g. when a new origin moves P or S by less than a sample
+	struct PeakMemo
+	{
+		uint64_t version;
+		const double *data;
+		size_t size, si1, si2;
+		double offset;
+		size_t index;
+	};
+	PeakMemo _peakMemo;
+	bool _havePeakMemo{false};
+
+	size_t memoizedPeak(const DoubleArray &data, size_t si1, size_t si2, double offset)
+	{
+		const PeakMemo &m = _peakMemo;
+		if (_havePeakMemo && m.version == _dataVersion && m.data == data.typedData() &&
+		    m.size == size_t(data.size()) && m.si1 == si1 && m.si2 == si2 && m.offset == offset) {
+			KCLASS_STAT_ADD(ReusedPeaks, 1);
+			SEISCOMP_DEBUG("Reusing peak at %lu", (unsigned long)m.index);
+			return m.index;
+		}
+
+		size_t index = findPeak(data, si1, si2, offset);
+		_peakMemo = PeakMemo{_dataVersion, data.typedData(), size_t(data.size()),
+		                     si1, si2, offset, index};
+		_havePeakMemo = true;
+		return index;
+	}
+
+	size_t findPeak(const DoubleArray &data, size_t si1, size_t si2, double offset)
+	{
+		unsigned long scanned = _peakSearch.scanned();
+		size_t index = _peakSearch.find(data.size(), data.typedData(), si1, si2, offset);
+		KCLASS_STAT_ADD(AmplitudeComputations, 1);
+		switch (_peakSearch.method()) {
+			case KClass::PeakSearch::RangeIndex:
+				SEISCOMP_DEBUG("Peak from range index");
+				break;
+			case KClass::PeakSearch::RangeBuild:
+				KCLASS_STAT_ADD(SamplesScanned, data.size());
+				SEISCOMP_DEBUG("Built range index over %d samples", data.size());
+				break;
+			default:
+				KCLASS_STAT_ADD(SamplesScanned, _peakSearch.scanned() - scanned);
+				SEISCOMP_DEBUG("Scanned %lu samples (%lu in total)",
+				               _peakSearch.scanned() - scanned, _peakSearch.scanned());
+				break;
+		}
+		return index;
+	}
+
+	void reset() override
+	{
+		Processing::AbstractAmplitudeProcessor_ML::reset();
+		_peakSearch.reset();
+		_havePeakMemo = false;
+		_inGap = false;
+		++_dataVersion;
+	}
+
+	// In fused filter mode the samples arrive filtered
+	void initFilter(double fsamp) override
+	{
+		if (_fusedFilter) {
+			AmplitudeProcessor::setFilter(nullptr);
+			AmplitudeProcessor::initFilter(fsamp);
+			return;
+		}
+		Processing::AbstractAmplitudeProcessor_ML::initFilter(fsamp);
+	}
+
+	// The buffer only receives records overlapping the time window, which
+	// is [P, S] for Z. Reserve it for that window on the first samples so
+	// that it is allocated once at its final size instead of growing by
+	// doubling, and release a buffer left over from a much longer window.
+	void fill(size_t n, double *samples) override
+	{
+		if (_fusedFilter) {
+			if (_filtered && n == _filteredCount) {
+				std::copy(_filtered, _filtered + n, samples);
+				_filtered = nullptr;
+				_inGap = false;
+			}
+			else {
+				// The lane of the parent is already past these samples,
+				// they are filtered on their own
+				if (!_inGap) {
+					_gapFilter.setLane(0, _fsamp, *_waResponse);
+					_inGap = true;
+				}
+				_gapFilter.apply(0, n, samples);
+			}
+		}
 
+		if (_data.size() == 0 && _fsamp > 0) {
+			size_t capacity = KClass::bufferCapacity(timeWindow().length(), _fsamp, n);
+			std::vector<double> &buffer = _data.impl();
+			if (buffer.capacity() > 2 * capacity) {
+				std::vector<double>().swap(buffer);
+			}
+			if (buffer.capacity() < capacity) {
+				buffer.reserve(capacity);
+				SEISCOMP_DEBUG("Reserved %lu samples for a %.1fs window",
+				               (unsigned long)capacity, timeWindow().length());
+			}
+		}
+		Processing::AbstractAmplitudeProcessor_ML::fill(n, samples);
+		++_dataVersion;
+	}
+
+	// Takes the geometry and travel times precomputed by the parent
+	// processor for this station
 	void setEnvironment(const DataModel::Origin *hypocenter,
 						const DataModel::SensorLocation *receiver,
-						const DataModel::Pick *pick) 
+						const DataModel::Pick *pick,
+						const StationEnvironment &env)
 		{
 			AmplitudeProcessor::setEnvironment(hypocenter, receiver, pick);
-			double dist, az, baz;
-			double hypoLat, hypoLon, hypoDepth;
-			double recvLat, recvLon;
-			try {
-				hypoLat   = _environment.hypocenter->latitude().value();
-				hypoLon   = _environment.hypocenter->longitude().value();
-				hypoDepth = _environment.hypocenter->depth().value();
-				recvLat   = _environment.receiver->latitude();
-				recvLon   = _environment.receiver->longitude();
-			}
-			catch (...) {
-				setStatus(Error, 1);
+			_peakSearch.reset();
+
+			if (env.geometryError) {
+				setStatus(Error, env.geometryError);
+				return;
+			}
+
+			if (env.distanceOutOfRange) {
+				setStatus(DistanceOutOfRange, env.distance);
+				return;
+			}
+
+			if (env.depthOutOfRange) {
+				setStatus(DepthOutOfRange, env.depth);
 				return;
 			}
-			Math::Geo::delazi_wgs84(hypoLat, hypoLon, recvLat, recvLon,
-								&dist, &az, &baz);
 
+			double dist = env.distance;
 			if ( dist < _config.minimumDistance || dist > _config.maximumDistance ) {
 			setStatus(DistanceOutOfRange, dist);
 			return;
@@ -140,69 +377,17 @@ class SimpleAmplitudeProcessor
 				SEISCOMP_DEBUG("setEnvironment: Horizontal component → using default");
 				return;
 			}
-			_haveP = _haveS = false;
-			// Compute station elevation if present (optional safe)
-			double recvElev = 0.0;
-			try {
-				recvElev = _environment.receiver->elevation();
-			} catch (...) {}
+			_arrivals = KClass::FirstArrivals();
 
-			// Compute travel times
-			TravelTimeList *ttlist =
-				_ttt->compute(hypoLat, hypoLon, hypoDepth,
-								recvLat, recvLon, recvElev, 1);
-
-			if (!ttlist || ttlist->isEmpty()) {
-				delete ttlist;
-				setStatus(Error, 3);
+			if (env.travelTimeError) {
+				setStatus(Error, env.travelTimeError);
 				return;
 			}
 
-			// Fetch P and S
-			// Added fix to find "Any" P and S
-			// As P and S are unavailable for events ~<250km
-			const char* pCandidates[] = {"Pg", "Pn", "P"};
-			const char* sCandidates[] = {"Sg", "Sn", "S"};
-
-			const TravelTime *tp = nullptr;
-			const TravelTime *ts = nullptr;
-
-			// Find the earliest P-type phase
-			for (const char* phaseName : pCandidates) {
-				const TravelTime *t = getPhase(ttlist, phaseName);
-				if (t) {
-					// If we haven't found a P yet, or if this one is earlier, keep it
-					if (!tp || t->time < tp->time) {
-						tp = t;
-					}
-				}
-			}
-
-			// Find the earliest S-type phase
-			for (const char* phaseName : sCandidates) {
-				const TravelTime *t = getPhase(ttlist, phaseName);
-				if (t) {
-					// If we haven't found an S yet, or if this one is earlier, keep it
-					if (!ts || t->time < ts->time) {
-						ts = t;
-					}
-				}
-			}
-			if (tp) {
-				_pArrival = _environment.hypocenter->time().value()
-							+ Core::TimeSpan(tp->time);
-				_haveP = true;
-			}
-
-			if (ts) {
-				_sArrival = _environment.hypocenter->time().value()
-							+ Core::TimeSpan(ts->time);
-				_haveS = true;
-			}
-
-			delete ttlist;
+			_arrivals = env.arrivals;
+			_originTime = _environment.hypocenter->time().value();
 
-			if (!_haveP || !_haveS) {
+			if (!_arrivals.haveP || !_arrivals.haveS) {
 				setStatus(Error, 5); // cannot create accurate window
 				return;
 			}
@@ -216,23 +401,27 @@ class SimpleAmplitudeProcessor
 			return AmplitudeProcessor::computeTimeWindow();
 		}
 
-		if (!_trigger || !_haveP || !_haveS) {
+		KClass::SignalWindow window;
+		if (!_trigger ||
+		    !KClass::verticalWindow(_arrivals, double(*_trigger - _originTime), window)) {
 			SEISCOMP_DEBUG("computeTimeWindow: Missing trigger or P/S arrivals → using default");
 			return AmplitudeProcessor::computeTimeWindow();
 		}
 
-		double _pOffset = double(_pArrival - *_trigger);
-		double _sOffset = double(_sArrival - *_trigger);
+		Core::Time pArrival = *_trigger + Core::TimeSpan(window.begin);
+		Core::Time sArrival = *_trigger + Core::TimeSpan(window.end);
+		double _pOffset = window.begin;
+		double _sOffset = window.end;
 		_config.signalBegin = _pOffset;
 		_config.signalEnd = _sOffset;
 
 		// Vertical component (Z): Custom window around P wave - from P to S arrivals - should be the P wave maximum
 		SEISCOMP_DEBUG("computeTimeWindow: Vertical component → custom P-wave window");
 		SEISCOMP_DEBUG("P wave arrival %s (offset %.3fs from trigger)",
-		               _pArrival.toString("%F %T.%f00000"), _pOffset);
+		               pArrival.toString("%F %T.%f00000"), _pOffset);
 		SEISCOMP_DEBUG("S wave arrival %s (offset %.3fs from trigger)",
-		               _sArrival.toString("%F %T.%f00000"), _sOffset);
-		AmplitudeProcessor::setTimeWindow(Core::TimeWindow(_pArrival, _sArrival));
+		               sArrival.toString("%F %T.%f00000"), _sOffset);
+		AmplitudeProcessor::setTimeWindow(Core::TimeWindow(pArrival, sArrival));
 		}
 
 		bool
@@ -242,7 +431,6 @@ class SimpleAmplitudeProcessor
 			AmplitudeValue *amplitude, double *period, double *snr) override
 		{
 			SEISCOMP_DEBUG ("Custom computeAmplitude called");
-			double maxAmplitude = 0.0;
 			size_t amp_index = 0;
 			if (usedComponent () == Vertical)
 			{
@@ -252,55 +440,61 @@ class SimpleAmplitudeProcessor
 					noise = *_noiseAmplitude;
 				}
 				SEISCOMP_DEBUG ("Vertical component noise is %f", noise);
-				amp_index = find_absmax (data.size (), data.typedData (), 0, data.size (), offset);
+				// The signal window was set to [P, S] in computeTimeWindow,
+				// so si1/si2 cover exactly the P-wave samples
+				amp_index = memoizedPeak (data, si1, si2, offset);
 				SEISCOMP_DEBUG ("Data size = %u",data.size ()); 
+				SEISCOMP_DEBUG ("P wave search from %u to %u", si1, si2);
 				SEISCOMP_DEBUG ("P wave max detected at %u",amp_index);
-				maxAmplitude = fabs (data[amp_index] - offset);
 			}
-			if (usedComponent () == FirstHorizontal || usedComponent () == SecondHorizontal)
+			else if (usedComponent () == FirstHorizontal || usedComponent () == SecondHorizontal)
 			{
-				amp_index = find_absmax (
-					data.size (), data.typedData (), si1, si2, offset);
+				amp_index = memoizedPeak (data, si1, si2, offset);
 				SEISCOMP_DEBUG ("si1 = %u", si1);
 				SEISCOMP_DEBUG ("S wave max detected at %u", amp_index);
 				SEISCOMP_DEBUG ("si2 is %u", si2);
-				maxAmplitude = fabs (data[amp_index] - offset);
 			}
-
-			if (maxAmplitude <= 0)
+			else
 			{
-				SEISCOMP_DEBUG (
-					"Amplitude computation failed: No valid peak found");
 				return false;
 			}
-			amplitude->value = maxAmplitude;
-			if (_streamConfig[targetComponent()].gain != 0.0)
-			{
-				amplitude->value /= _streamConfig[targetComponent()].gain;
-				// mm to μm conversion
-				amplitude->value *= 1E03;
-				amplitude->value = std::abs (amplitude->value);
-				dt->index = amp_index;
-				*period = -1;
-				*snr = -1;
 
+			KClass::AmplitudeStatus status = KClass::peakAmplitude (
+				data[amp_index], offset, _streamConfig[targetComponent()].gain,
+				amplitude->value);
+			if (status == KClass::NoPeak)
+			{
 				SEISCOMP_DEBUG (
-					"Amplitude computed: value=%f, period=%f, snr=%f",
-					amplitude->value, *period, *snr);
-
-				return true;
+					"Amplitude computation failed: No valid peak found");
+				return false;
 			}
-			else
+			if (status != KClass::AmplitudeOK)
 			{
 				return false;
 			}
+
+			dt->index = amp_index;
+			*period = -1;
+			*snr = -1;
+
+			SEISCOMP_DEBUG (
+				"Amplitude computed: value=%f, period=%f, snr=%f",
+				amplitude->value, *period, *snr);
+
+			return true;
 	}
 };
 
 class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 {
   public:
-  	TravelTimeTableInterfacePtr _ttt;
+	// Travel-time table, acquired on the thread that evaluates it
+	std::string _ttInterface;
+	std::string _ttModel;
+	std::shared_ptr<const KClass::TravelTimeGrid> _ttGrid;
+	std::shared_ptr<const KClass::LayeredModel> _layered;
+	uint32_t _ttTable{0};
+
 	AmplitudeProcessor_K_Class ()
 		: Processing::AmplitudeProcessor (MAG_TYPE)
 	{	
@@ -314,12 +508,9 @@ class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 		_ampE.setUsedComponent (SecondHorizontal);
 		_ampZ.setUsedComponent (Vertical);
 
-		_ampN.setPublishFunction (boost::bind (
-			&AmplitudeProcessor_K_Class::newAmplitude, this, boost::placeholders::_1, boost::placeholders::_2));
-		_ampE.setPublishFunction (boost::bind (
-			&AmplitudeProcessor_K_Class::newAmplitude, this, boost::placeholders::_1, boost::placeholders::_2));
-		_ampZ.setPublishFunction (boost::bind (
-			&AmplitudeProcessor_K_Class::newAmplitude, this, boost::placeholders::_1, boost::placeholders::_2));
+		_ampN.setPublishFunction (Publisher{this});
+		_ampE.setPublishFunction (Publisher{this});
+		_ampZ.setPublishFunction (Publisher{this});
 	}
 
 	bool
@@ -332,6 +523,9 @@ class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 		_ampN.streamConfig (FirstHorizontalComponent) = streamConfig (FirstHorizontalComponent);
 		_ampE.streamConfig (SecondHorizontalComponent) = streamConfig (SecondHorizontalComponent);
 		_ampZ.streamConfig (VerticalComponent) = streamConfig (VerticalComponent);
+		resolveChannels ();
+
+		SEISCOMP_DEBUG ("Using %s abs-max kernel", KClass::find_absmax_implementation ());
 
 		if (!Processing::AmplitudeProcessor::setup (settings))
 		{
@@ -360,21 +554,347 @@ class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 			model = "iasp91";
 			SEISCOMP_DEBUG("No model configured, using defaults");
 		}
-		_ttt = TravelTimeTableInterface::Create(interface.c_str());
-		_ttt->setModel(model.c_str());
-		_ampZ.setTravelTimeTable(_ttt);
+		try {
+			int cacheSize = settings.getInt("amplitudes.K_Class.ttCacheSize");
+			if (cacheSize >= 0) {
+				KClass::TravelTimeCache::Instance().setCapacity(cacheSize);
+			}
+		}
+		catch (...) {}
+
+		// The built-in layered model replaces the travel-time table
+		std::string engine = "table";
+		try {
+			engine = settings.getString("amplitudes.K_Class.ttEngine");
+		}
+		catch (...) {}
+
+		_ttGrid = nullptr;
+		_layered = nullptr;
+		if (engine == "layered") {
+			// A list parameter, one layer per element
+			std::vector<std::string> entries;
+			std::string text = KClass::LayeredModel::DefaultModel;
+			if (settings.getValue(entries, "amplitudes.K_Class.layeredModel") && !entries.empty()) {
+				text = joinList(entries);
+			}
+			else {
+				SEISCOMP_DEBUG("amplitudes.K_Class.layeredModel not set, using the default model");
+			}
+
+			std::vector<KClass::LayeredModel::Layer> layers;
+			std::shared_ptr<KClass::LayeredModel> layered = std::make_shared<KClass::LayeredModel>();
+			if (!KClass::LayeredModel::Parse(text, layers) || !layered->set(layers)) {
+				SEISCOMP_ERROR("Invalid layered model: %s", text.c_str());
+				return false;
+			}
+			SEISCOMP_DEBUG("Using layered model %s", text.c_str());
+			_layered = layered;
+			interface = "layered";
+			model = text;
+		}
+		else if (engine == "table") {
+			// Checks the configuration, the table is acquired again by the
+			// threads computing travel times
+			if (!KClass::TravelTimeTablePool::Acquire(interface, model)) {
+				SEISCOMP_ERROR("Unable to load travel-time table %s/%s", interface, model);
+				return false;
+			}
+		}
+		else {
+			SEISCOMP_ERROR("Unknown travel-time engine: %s", engine.c_str());
+			return false;
+		}
+		_ttInterface = interface;
+		_ttModel = model;
+		_ttTable = KClass::TravelTimeCache::Instance().table(interface, model);
+
+		// Incremental mode: components compute their amplitude while data
+		// arrives, each update only scans the new samples
+		_incremental = false;
+		try {
+			_incremental = settings.getBool("amplitudes.K_Class.incremental");
+		}
+		catch (...) {}
+		_ampN.setUpdateEnabled(_incremental);
+		_ampE.setUpdateEnabled(_incremental);
+		_ampZ.setUpdateEnabled(_incremental);
+
+		// Parallel mode: the components are reprocessed concurrently on a
+		// shared pool. Records fed on the live path are not parallelized.
+		_parallel = false;
+		try {
+			_parallel = settings.getBool("amplitudes.K_Class.parallel");
+		}
+		catch (...) {}
+
+		// Provisional mode: emit a preliminary amplitude as soon as Z and one
+		// horizontal are complete, the final one follows
+		_provisional = false;
+		try {
+			_provisional = settings.getBool("amplitudes.K_Class.provisional");
+		}
+		catch (...) {}
+
+		// Fused filter mode: the Wood-Anderson simulation of the three
+		// components runs in one pass here instead of once per component
+		bool fused = false;
+		try {
+			fused = settings.getBool("amplitudes.K_Class.fusedFilter");
+		}
+		catch (...) {}
+		for (Component comp : {VerticalComponent, FirstHorizontalComponent,
+		                       SecondHorizontalComponent}) {
+			if (fused && _streamConfig[comp].gainUnit != "M/S") {
+				SEISCOMP_WARNING("Fused filter needs velocity data, %s is in %s",
+				                 _streamConfig[comp].code().c_str(),
+				                 _streamConfig[comp].gainUnit.c_str());
+				fused = false;
+			}
+		}
+		// The fused filter simulates the response from velocity, a response
+		// correction would only be applied by the per-component filters
+		bool responses = false;
+		try {
+			responses = settings.getBool("amplitudes.enableResponses");
+		}
+		catch (...) {}
+		try {
+			responses = settings.getBool("amplitudes.K_Class.enableResponses");
+		}
+		catch (...) {}
+		if (fused && responses) {
+			SEISCOMP_WARNING("Fused filter does not correct responses, using the "
+			                 "per-component filters");
+			fused = false;
+		}
+		try {
+			_waResponse.gain = settings.getDouble("amplitudes.WoodAnderson.gain");
+		}
+		catch (...) {}
+		try {
+			_waResponse.period = settings.getDouble("amplitudes.WoodAnderson.T0");
+		}
+		catch (...) {}
+		try {
+			_waResponse.damping = settings.getDouble("amplitudes.WoodAnderson.h");
+		}
+		catch (...) {}
+		_fused = fused;
+		_ampZ._fusedFilter = _fused ? &_fusedFilter : nullptr;
+		_ampN._fusedFilter = _fused ? &_fusedFilter : nullptr;
+		_ampE._fusedFilter = _fused ? &_fusedFilter : nullptr;
+		_ampZ._waResponse = &_waResponse;
+		_ampN._waResponse = &_waResponse;
+		_ampE._waResponse = &_waResponse;
+		_ampZ._fusedLane = VerticalComponent;
+		_ampN._fusedLane = FirstHorizontalComponent;
+		_ampE._fusedLane = SecondHorizontalComponent;
+
+		bool useGrid = false;
+		try {
+			useGrid = settings.getBool("amplitudes.K_Class.ttGrid");
+		}
+		catch (...) {}
+
+		if (useGrid && _layered) {
+			SEISCOMP_DEBUG("Travel-time grid not used with the layered model");
+		}
+		else if (useGrid) {
+			KClass::TravelTimeGrid::Parameters params;
+			params.table = interface + "/" + model;
+			params.maxDistance = DELTA_MAX;
+			params.maxDepth = DEPTH_MAX;
+			params.distanceStep = 0.02;
+			params.depthStep = 1.0;
+			std::string file;
+			try {
+				params.distanceStep = settings.getDouble("amplitudes.K_Class.ttGridDistanceStep");
+			}
+			catch (...) {}
+			try {
+				params.depthStep = settings.getDouble("amplitudes.K_Class.ttGridDepthStep");
+			}
+			catch (...) {}
+			try {
+				file = settings.getString("amplitudes.K_Class.ttGridFile");
+			}
+			catch (...) {}
+
+			// The grid is built for receivers at sea level, elevated ones
+			// are only evaluated for its error estimate
+			std::string ttInterface = interface, ttModel = model;
+			std::shared_ptr<const KClass::TravelTimeGrid> grid =
+				KClass::TravelTimeGrid::Shared(params, file,
+					[ttInterface, ttModel](double distance, double depth, double elevation,
+					                       KClass::FirstArrivals &arrivals) {
+						TravelTimeTableInterfacePtr ttt =
+							KClass::TravelTimeTablePool::Acquire(ttInterface, ttModel);
+						return ttt && computeFirstArrivals(ttt.get(), 0.0, 0.0, depth,
+						                                   0.0, distance, elevation * 1E3, arrivals);
+					},
+					[&params, &file](size_t evaluations, double seconds) {
+						SEISCOMP_INFO("Building travel-time grid %s: %lu evaluations, about "
+						              "%.0fs%s%s", params.table, (unsigned long)evaluations,
+						              seconds, file.empty() ? "" : ", saved to ", file);
+					});
+
+			if (!grid) {
+				SEISCOMP_ERROR("Invalid travel-time grid parameters");
+				return false;
+			}
+
+			static std::atomic<const KClass::TravelTimeGrid*> reported{nullptr};
+			if (reported.exchange(grid.get()) != grid.get()) {
+				SEISCOMP_INFO("Travel-time grid %s: %.3f deg x %.1f km, max "
+				              "interpolation error up to %.1f km elevation P %.4fs, S %.4fs",
+				              params.table, params.distanceStep, params.depthStep,
+				              KClass::TravelTimeGrid::MaxCheckedElevation,
+				              grid->maxErrorP(), grid->maxErrorS());
+			}
+
+			_ttGrid = grid;
+		}
+
+#ifdef K_CLASS_STATISTICS
+		double statisticsInterval = 60.0;
+		try {
+			statisticsInterval = settings.getDouble("amplitudes.K_Class.statisticsInterval");
+		}
+		catch (...) {}
+		KClass::Statistics::Start(statisticsInterval, [](const std::string &summary) {
+			SEISCOMP_INFO("K_Class statistics: %s", summary.c_str());
+		});
+#endif
 		return true;
 	}
 
+	// Geometry and first arrivals of one receiver, computed once for the
+	// three components. Allocates nothing unless the travel times have to be
+	// computed by the table.
+	void
+	prepareEnvironment (
+		double hypoLat, double hypoLon, double hypoDepth,
+		const DataModel::SensorLocation *receiver,
+		StationEnvironment &env) const
+	{
+		double recvLat, recvLon;
+		try {
+			recvLat = receiver->latitude();
+			recvLon = receiver->longitude();
+		}
+		catch (...) {
+			env.geometryError = 1;
+			return;
+		}
+
+		double az, baz;
+		Math::Geo::delazi_wgs84(hypoLat, hypoLon, recvLat, recvLon,
+		                        &env.distance, &az, &baz);
+		env.depth = hypoDepth;
+
+		// Out-of-range stations and sources are rejected with the range of
+		// the vertical component before any travel time is computed or
+		// cached
+		const Config &range = _ampZ.config();
+		if (env.distance < range.minimumDistance || env.distance > range.maximumDistance) {
+			env.distanceOutOfRange = true;
+			return;
+		}
+		if (hypoDepth < range.minimumDepth || hypoDepth > range.maximumDepth) {
+			env.depthOutOfRange = true;
+			return;
+		}
+
+		// Compute station elevation if present (optional safe)
+		double recvElev = 0.0;
+		try {
+			recvElev = receiver->elevation();
+		} catch (...) {}
+
+		// The layered model is evaluated directly, it is cheaper than
+		// a cache lookup
+		KClass::FirstArrivals &arrivals = env.arrivals;
+		if (_layered) {
+			bool computed;
+			{
+				KCLASS_STAT_SCOPE(TravelTimeCompute);
+				computed = _layered->firstArrivals(env.distance * KClass::KmPerDegree,
+				                                   hypoDepth, recvElev * 1E-3, arrivals);
+			}
+			if (!computed)
+				env.travelTimeError = 3;
+			return;
+		}
+
+		// The precomputed grid covers sources inside the plugin's
+		// envelope, anything else goes through the exact path
+		if (_ttGrid && _ttGrid->interpolate(env.distance, hypoDepth, recvElev * 1E-3, arrivals)
+		    && arrivals.haveP && arrivals.haveS)
+			return;
+
+		// Compute travel times, relocations of the same origin and
+		// neighbouring stations mostly hit the shared cache
+		KClass::TravelTimeCache &cache = KClass::TravelTimeCache::Instance();
+		KClass::TravelTimeCache::Key key =
+			KClass::TravelTimeCache::makeKey(_ttTable, hypoDepth, env.distance, recvElev);
+
+		if (!cache.lookup(key, arrivals)) {
+			bool computed;
+			{
+				KCLASS_STAT_SCOPE(TravelTimeCompute);
+				TravelTimeTableInterfacePtr ttt =
+					KClass::TravelTimeTablePool::Acquire(_ttInterface, _ttModel);
+				computed = ttt && computeFirstArrivals(ttt.get(), hypoLat, hypoLon, hypoDepth,
+				                                       recvLat, recvLon, recvElev, arrivals);
+			}
+			if (!computed) {
+				env.travelTimeError = 3;
+				return;
+			}
+			cache.insert(key, arrivals);
+		}
+
+		uint64_t lookups = cache.hits() + cache.misses();
+		if (lookups % 10000 == 0) {
+			SEISCOMP_INFO("Travel-time cache: %lu hits, %lu misses, %lu entries",
+			              (unsigned long)cache.hits(), (unsigned long)cache.misses(),
+			              (unsigned long)cache.size());
+		}
+	}
+
 	void
 	setEnvironment (
 		const DataModel::Origin *hypocenter,
 		const DataModel::SensorLocation *receiver,
 		const DataModel::Pick *pick) override
 	{
-		_ampE.setEnvironment (hypocenter, receiver, pick);
-		_ampN.setEnvironment (hypocenter, receiver, pick);
-		_ampZ.setEnvironment (hypocenter, receiver, pick);
+		StationEnvironment env;
+		env.geometryError = 1;
+		if (hypocenter && receiver) {
+			try {
+				double hypoLat = hypocenter->latitude().value();
+				double hypoLon = hypocenter->longitude().value();
+				double hypoDepth = hypocenter->depth().value();
+				env.geometryError = 0;
+				prepareEnvironment (hypoLat, hypoLon, hypoDepth, receiver, env);
+			}
+			catch (...) {}
+		}
+		setEnvironment (hypocenter, receiver, pick, env);
+	}
+
+	// Hands the precomputed environment to the components
+	void
+	setEnvironment (
+		const DataModel::Origin *hypocenter,
+		const DataModel::SensorLocation *receiver,
+		const DataModel::Pick *pick,
+		const StationEnvironment &env)
+	{
+		_ampE.setEnvironment (hypocenter, receiver, pick, env);
+		_ampN.setEnvironment (hypocenter, receiver, pick, env);
+		_ampZ.setEnvironment (hypocenter, receiver, pick, env);
 		if (_ampZ.status() == DistanceOutOfRange) 
 		{
             setStatus(DistanceOutOfRange, _ampZ.statusValue());
@@ -442,18 +962,94 @@ class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 		return _ampN.capabilities () | _ampE.capabilities () | _ampZ.capabilities ();
 	}
 
+	// Tags provisional amplitudes with a comment, which is removed again
+	// when the final amplitude updates the object
+	void finalizeAmplitude (DataModel::Amplitude *amplitude) const override
+	{
+		AmplitudeProcessor::finalizeAmplitude (amplitude);
+
+		DataModel::Comment *comment =
+			amplitude->comment (DataModel::CommentIndex (PRELIMINARY_COMMENT));
+		if (_preliminary && !comment)
+		{
+			DataModel::CommentPtr tag = new DataModel::Comment;
+			tag->setId (PRELIMINARY_COMMENT);
+			tag->setText ("preliminary: one horizontal component is missing");
+			amplitude->add (tag.get ());
+		}
+		else if (!_preliminary && comment)
+		{
+			amplitude->remove (comment);
+		}
+	}
+
 	void reprocess (OPT (double) searchBegin, OPT (double) searchEnd) override
 	{
+		KCLASS_STAT_ADD (Reprocesses, 1);
 		setStatus (WaitingForData, 0);
 		_ampN.setConfig (config ());
 		_ampE.setConfig (config ());
+		// The shared configuration carries the signal window of the
+		// horizontals, the [P, S] window of Z is derived again
 		_ampZ.setConfig (config ());
+		_ampZ.computeTimeWindow ();
 
 		_results[0] = _results[1] = _results[2] = Core::None;
+		_provisionalEmitted = false;
+
+		// Components whose data and window did not change since their
+		// last result keep it without being reprocessed
+		_searchBegin = searchBegin;
+		_searchEnd = searchEnd;
+		bool rerun[3];
+		size_t reruns = 0;
+		for (int idx = 0; idx < 3; ++idx)
+		{
+			const SimpleAmplitudeProcessor &amp = component (idx);
+			rerun[idx] = !_memo[idx].valid || amp.status () != Finished ||
+			             !(_memo[idx].key == windowKey (amp));
+			if (rerun[idx])
+			{
+				++reruns;
+			}
+			else
+			{
+				_results[idx] = _memo[idx].result;
+			}
+		}
 
-		_ampN.reprocess (searchBegin, searchEnd);
-		_ampE.reprocess (searchBegin, searchEnd);
-		_ampZ.reprocess (searchBegin, searchEnd);
+		++_reprocessCount;
+		_recomputeCount += reruns;
+		KCLASS_STAT_ADD (ComponentReprocesses, reruns);
+		KCLASS_STAT_ADD (ReusedResults, 3 - reruns);
+		SEISCOMP_DEBUG ("Reprocess %lu: reprocessing %lu of 3 components, %lu of %lu so far",
+		                (unsigned long)_reprocessCount, (unsigned long)reruns,
+		                (unsigned long)_recomputeCount, (unsigned long)(3 * _reprocessCount));
+
+		if (_parallel && reruns > 1)
+		{
+			runParallel (
+				[&] { if (rerun[1]) _ampN.reprocess (searchBegin, searchEnd); },
+				[&] { if (rerun[0]) _ampE.reprocess (searchBegin, searchEnd); },
+				[&] { if (rerun[2]) _ampZ.reprocess (searchBegin, searchEnd); });
+		}
+		else
+		{
+			// Results are collected and published once, as in parallel
+			// mode, so that reused results do not change the order
+			_collecting = true;
+			if (rerun[1])
+				_ampN.reprocess (searchBegin, searchEnd);
+			if (rerun[0])
+				_ampE.reprocess (searchBegin, searchEnd);
+			if (rerun[2])
+				_ampZ.reprocess (searchBegin, searchEnd);
+			_collecting = false;
+			selectLastRecord ();
+		}
+		_searchBegin = Core::None;
+		_searchEnd = Core::None;
+		publishIfComplete ();
 
 		if (!isFinished ())
 		{
@@ -470,6 +1066,7 @@ class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 	setTrigger (const Core::Time &trigger) override
 	{
 		AmplitudeProcessor::setTrigger (trigger);
+		KCLASS_STAT_MARK (_triggerClock);
 		_ampE.setTrigger (trigger);
 		_ampN.setTrigger (trigger);
 		_ampZ.setTrigger (trigger);
@@ -480,6 +1077,21 @@ class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 	{
 		AmplitudeProcessor::reset ();
 		_results[0] = _results[1] = _results[2] = Core::None;
+		for (ComponentMemo &memo : _memo)
+		{
+			memo.valid = false;
+		}
+		_lastRecord = nullptr;
+		_provisionalEmitted = false;
+		_preliminary = false;
+		for (FusedLane &lane : _fusedLanes)
+		{
+			lane.fsamp = 0;
+		}
+		for (std::vector<RecordCPtr> &pending : _fusedPending)
+		{
+			pending.clear ();
+		}
 
 		_ampE.reset ();
 		_ampN.reset ();
@@ -498,46 +1110,254 @@ class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 			return false;
 		}
 
-		if (record->channelCode () == _streamConfig[FirstHorizontalComponent].code ())
-		{
-			_ampN.feed (record);
-		}
-		else if (record->channelCode () == _streamConfig[SecondHorizontalComponent].code ())
-		{
-			_ampE.feed (record);
-		}
-		else if (record->channelCode () == _streamConfig[VerticalComponent].code ())
-		{
-			SEISCOMP_DEBUG (
-				"Adding stream %s",
-				_streamConfig[VerticalComponent].code ().c_str ());
-			_ampZ.feed (record);
-		}
-		else
+		switch (channelIndex (record))
 		{
+		case ChannelN:
+			KCLASS_STAT_ADD (FeedN, 1);
+			feedComponent (_ampN, record);
+			break;
+		case ChannelE:
+			KCLASS_STAT_ADD (FeedE, 1);
+			feedComponent (_ampE, record);
+			break;
+		case ChannelZ:
+			KCLASS_STAT_ADD (FeedZ, 1);
+			feedComponent (_ampZ, record);
+			break;
+		default:
+			KCLASS_STAT_ADD (RejectedRecords, 1);
 			SEISCOMP_WARNING (
 				"Record with channel %s does not match N, E, or Z channels",
 				record->channelCode ().c_str ());
 			return false;
 		}
+		publishIfComplete ();
 		return true;
 	}
 
   private:
-	bool
-	computeAmplitude (
-		const DoubleArray &data, size_t i1, size_t i2, size_t si1,
-		size_t si2, double offset, AmplitudeIndex *dt,
-		AmplitudeValue *amplitude, double *period, double *snr) override
+	// Longest time span of records waiting for the other components in
+	// fused filter mode (s)
+	static constexpr double FusedMaxDelay = 5.0;
+
+	// Lookup order of the channel codes, a code configured for several
+	// components goes to the first of them as before
+	enum
 	{
-		return false;
-	}
+		ChannelN,
+		ChannelE,
+		ChannelZ
+	};
+
 	void
-	newAmplitude (
-		const AmplitudeProcessor *proc,
-		const AmplitudeProcessor::Result &res)
+	resolveChannels ()
 	{
-		if (isFinished ())
+		_channels.clear ();
+		_channels.set (ChannelN, _streamConfig[FirstHorizontalComponent].code ());
+		_channels.set (ChannelE, _streamConfig[SecondHorizontalComponent].code ());
+		_channels.set (ChannelZ, _streamConfig[VerticalComponent].code ());
+		_channelsResolved = true;
+
+		SEISCOMP_DEBUG ("Channels N: %s, E: %s, Z: %s",
+		                _streamConfig[FirstHorizontalComponent].code ().c_str (),
+		                _streamConfig[SecondHorizontalComponent].code ().c_str (),
+		                _streamConfig[VerticalComponent].code ().c_str ());
+	}
+
+	// Resolved on setup, feeding without setup resolves on first use
+	int
+	channelIndex (const Record *record)
+	{
+		if (!_channelsResolved)
+		{
+			resolveChannels ();
+		}
+		return _channels.find (record->channelCode ());
+	}
+
+	// Feeds one record to a component. In fused filter mode records wait
+	// until all components have one, so that they are filtered in one pass.
+	// A component without data holds back the others for at most
+	// FusedMaxDelay seconds, a finished one not at all. Records reaching the
+	// end of the time window of their component are fed at once, as no
+	// more data may follow.
+	void
+	feedComponent (SimpleAmplitudeProcessor &proc, const Record *record)
+	{
+		if (!_fused)
+		{
+			proc.feed (record);
+			return;
+		}
+
+		_fusedPending[proc._fusedLane].push_back (record);
+
+		bool complete = true;
+		bool flush = false;
+		for (const SimpleAmplitudeProcessor *component : {&_ampZ, &_ampN, &_ampE})
+		{
+			const std::vector<RecordCPtr> &pending = _fusedPending[component->_fusedLane];
+			if (pending.empty ())
+			{
+				complete = complete && component->isFinished ();
+				continue;
+			}
+
+			const Core::TimeWindow &window = component->timeWindow ();
+			if (double (pending.back ()->endTime () - pending.front ()->startTime ()) >
+			        FusedMaxDelay ||
+			    (window.length () > 0 && pending.back ()->endTime () >= window.endTime ()))
+			{
+				flush = true;
+			}
+		}
+
+		if (complete || flush)
+		{
+			flushFused ();
+		}
+	}
+
+	// Filters and feeds the waiting records
+	void
+	flushFused ()
+	{
+		for (int idx = 0; idx < 3; ++idx)
+		{
+			_fusedStreams[idx].clear ();
+			for (const RecordCPtr &record : _fusedPending[idx])
+			{
+				_fusedStreams[idx].push_back (record.get ());
+			}
+		}
+
+		prefilter (_fusedStreams);
+		for (SimpleAmplitudeProcessor *proc : {&_ampZ, &_ampN, &_ampE})
+		{
+			const std::vector<const Record *> &stream = _fusedStreams[proc->_fusedLane];
+			for (size_t i = 0; i < stream.size (); ++i)
+			{
+				setFiltered (*proc, i);
+				proc->feed (stream[i]);
+			}
+		}
+
+		for (std::vector<RecordCPtr> &pending : _fusedPending)
+		{
+			pending.clear ();
+		}
+	}
+
+	// Converts the records of each component and runs the Wood-Anderson
+	// simulation over them, over all three components in one pass where
+	// they have samples. A component restarts its filter with its first
+	// record, after a gap and when the sampling frequency changes.
+	void
+	prefilter (const std::vector<const Record *> *streams)
+	{
+		for (int idx = 0; idx < 3; ++idx)
+		{
+			FusedLane &lane = _fusedLanes[idx];
+			lane.samples.clear ();
+			lane.offsets.assign (1, 0);
+			lane.runs.clear ();
+			for (const Record *record : streams[idx])
+			{
+				const Array *data = record->data ();
+				ArrayPtr converted;
+				const DoubleArray *values = data ? DoubleArray::ConstCast (data) : nullptr;
+				if (data && !values)
+				{
+					converted = data->copy (Array::DOUBLE);
+					values = DoubleArray::ConstCast (converted.get ());
+				}
+
+				double fsamp = record->samplingFrequency ();
+				if (values && values->size () > 0 && fsamp > 0)
+				{
+					if (fsamp != lane.fsamp ||
+					    std::fabs (double (record->startTime () - lane.end)) > 0.5 / fsamp)
+					{
+						lane.runs.push_back ({lane.samples.size (), fsamp});
+					}
+					lane.samples.insert (lane.samples.end (), values->typedData (),
+					                     values->typedData () + values->size ());
+					lane.fsamp = fsamp;
+					lane.end = record->endTime ();
+				}
+				lane.offsets.push_back (lane.samples.size ());
+			}
+			lane.runs.push_back ({lane.samples.size (), 0.0});
+		}
+
+		size_t pos[3] = {0, 0, 0};
+		size_t run[3] = {0, 0, 0};
+		for (;;)
+		{
+			size_t end[3];
+			int active = 0;
+			for (int idx = 0; idx < 3; ++idx)
+			{
+				FusedLane &lane = _fusedLanes[idx];
+				while (run[idx] + 1 < lane.runs.size () && lane.runs[run[idx]].start == pos[idx])
+				{
+					_fusedFilter.setLane (idx, lane.runs[run[idx]].fsamp, _waResponse);
+					++run[idx];
+				}
+				end[idx] = lane.runs[run[idx]].start;
+				active += pos[idx] < end[idx];
+			}
+
+			if (active == 0)
+			{
+				break;
+			}
+
+			if (active == 3)
+			{
+				size_t n = std::min (end[0] - pos[0], std::min (end[1] - pos[1], end[2] - pos[2]));
+				_fusedFilter.apply (n, _fusedLanes[0].samples.data () + pos[0],
+				                    _fusedLanes[1].samples.data () + pos[1],
+				                    _fusedLanes[2].samples.data () + pos[2]);
+				for (size_t &p : pos)
+				{
+					p += n;
+				}
+				continue;
+			}
+
+			for (int idx = 0; idx < 3; ++idx)
+			{
+				_fusedFilter.apply (idx, end[idx] - pos[idx],
+				                    _fusedLanes[idx].samples.data () + pos[idx]);
+				pos[idx] = end[idx];
+			}
+		}
+	}
+
+	// Passes the filtered samples of record i of the last prefilter call
+	void
+	setFiltered (SimpleAmplitudeProcessor &proc, size_t i)
+	{
+		const FusedLane &lane = _fusedLanes[proc._fusedLane];
+		proc._filtered = lane.samples.data () + lane.offsets[i];
+		proc._filteredCount = lane.offsets[i + 1] - lane.offsets[i];
+	}
+
+	bool
+	computeAmplitude (
+		const DoubleArray &data, size_t i1, size_t i2, size_t si1,
+		size_t si2, double offset, AmplitudeIndex *dt,
+		AmplitudeValue *amplitude, double *period, double *snr) override
+	{
+		return false;
+	}
+	void
+	newAmplitude (
+		const AmplitudeProcessor *proc,
+		const AmplitudeProcessor::Result &res)
+	{
+		if (isFinished ())
 		{
 			return;
 		}
@@ -556,57 +1376,316 @@ class AmplitudeProcessor_K_Class : public Processing::AmplitudeProcessor
 			idx = 2;
 		}
 
+		std::lock_guard<std::mutex> lock (_resultMutex);
 		_results[idx] = ComponentResult ();
 		_results[idx]->value = res.amplitude;
 		_results[idx]->time = res.time;
-
-		if (_results[0] && _results[1] && _results[2])
+		_results[idx]->record = res.record;
+		_memo[idx].valid = true;
+		_memo[idx].key = windowKey (component (idx));
+		_memo[idx].result = *_results[idx];
+
+		// Components running in parallel only store their results, the
+		// station amplitude is published by the calling thread
+		if (_collecting)
 		{
-			setStatus (Finished, 100.);
-			Result newRes;
-			newRes.record = res.record;
-			newRes.component = Any;
+			return;
+		}
 
-			if (_results[0]->value.value > _results[1]->value.value)
-			{
-				newRes.amplitude = summ (_results[0]->value, _results[2]->value);
-				newRes.time = average (_results[0]->time, _results[2]->time);
-			}
-			else
+		_lastRecord = res.record;
+		publishIfComplete ();
+	}
+
+	// Runs the three component tasks on the shared pool and waits for them
+	template <typename N, typename E, typename Z>
+	void
+	runParallel (N n, E e, Z z)
+	{
+		KClass::TaskPool &pool = KClass::TaskPool::Shared ();
+		KClass::TaskPool::Group group;
+
+		_collecting = true;
+		pool.run (group, n);
+		pool.run (group, e);
+		pool.run (group, z);
+		pool.wait (group);
+		_collecting = false;
+
+		selectLastRecord ();
+	}
+
+	// Uses the record of the component that completes last in the serial
+	// order (N, E, Z) so that the result does not depend on the scheduling
+	void
+	selectLastRecord ()
+	{
+		for (int idx : {2, 0, 1})
+		{
+			if (_results[idx])
 			{
-				newRes.amplitude = summ (_results[1]->value, _results[2]->value);
-				newRes.time = average (_results[1]->time, _results[2]->time);
+				_lastRecord = _results[idx]->record;
+				break;
 			}
-			newRes.period = -1;
-			newRes.snr = -1;
+		}
+	}
+
+	// Component of result index idx
+	SimpleAmplitudeProcessor &
+	component (int idx) const
+	{
+		return idx == 0 ? _ampE : idx == 1 ? _ampN : _ampZ;
+	}
 
-			emitAmplitude (newRes);
+	// Inputs a component result depends on besides the configuration. The
+	// windows enter as sample indices into the component data, computed as
+	// the amplitude processor does, so that an origin moving P or S by less
+	// than a sample gives the same key.
+	struct WindowKey
+	{
+		uint64_t version;
+		bool triggered;
+		Core::Time dataStart;
+		int windowStart, windowEnd;
+		int noiseBegin, noiseEnd, signalBegin, signalEnd;
+		int searchBegin, searchEnd;
+
+		bool
+		operator== (const WindowKey &other) const
+		{
+			return version == other.version && triggered == other.triggered &&
+			       dataStart == other.dataStart && windowStart == other.windowStart &&
+			       windowEnd == other.windowEnd && noiseBegin == other.noiseBegin &&
+			       noiseEnd == other.noiseEnd && signalBegin == other.signalBegin &&
+			       signalEnd == other.signalEnd && searchBegin == other.searchBegin &&
+			       searchEnd == other.searchEnd;
 		}
+	};
+
+	WindowKey
+	windowKey (const SimpleAmplitudeProcessor &amp) const
+	{
+		const Config &cfg = amp.config ();
+		WindowKey key;
+		key.version = amp._dataVersion;
+		key.triggered = static_cast<bool> (amp._trigger);
+		key.dataStart = amp.dataTimeWindow ().startTime ();
+
+		// Offsets from the trigger, or from the data start without one
+		double fsamp = amp._fsamp;
+		double dt = key.triggered ? double (*amp._trigger - key.dataStart) : 0.0;
+		auto index = [dt, fsamp] (double offset) { return int ((dt + offset) * fsamp); };
+		const int none = std::numeric_limits<int>::min ();
+
+		key.windowStart = int (double (amp.timeWindow ().startTime () - key.dataStart) * fsamp);
+		key.windowEnd = int (double (amp.timeWindow ().endTime () - key.dataStart) * fsamp);
+		key.noiseBegin = index (cfg.noiseBegin);
+		key.noiseEnd = index (cfg.noiseEnd);
+		key.signalBegin = index (cfg.signalBegin);
+		key.signalEnd = index (cfg.signalEnd);
+		key.searchBegin = _searchBegin ? index (*_searchBegin) : none;
+		key.searchEnd = _searchEnd ? index (*_searchEnd) : none;
+		return key;
+	}
+
+	// Publish function of the components. A single pointer fits into the
+	// small object buffer of the function wrapper, so unlike a bound member
+	// function it is stored and called without allocating.
+	struct Publisher
+	{
+		AmplitudeProcessor_K_Class *owner;
+
+		void
+		operator() (const AmplitudeProcessor *proc, const Result &res) const
+		{
+			owner->newAmplitude (proc, res);
+		}
+	};
+
+	// Emits the station amplitude once all components have a result. In
+	// incremental mode results are updated while data arrives, so the
+	// components also have to be finished. In provisional mode a preliminary
+	// amplitude of Z and the first finished horizontal is emitted before.
+	void
+	publishIfComplete ()
+	{
+		if (isFinished ())
+		{
+			return;
+		}
+
+		bool complete = _results[0] && _results[1] && _results[2];
+		if (_incremental &&
+		    (!_ampE.isFinished () || !_ampN.isFinished () || !_ampZ.isFinished ()))
+		{
+			complete = false;
+		}
+
+		if (complete)
+		{
+			setStatus (Finished, 100.);
+			emitStationAmplitude (
+				_results[0]->value.value > _results[1]->value.value ? 0 : 1, false);
+			return;
+		}
+
+		if (!_provisional || _provisionalEmitted || !_results[2] || !_ampZ.isFinished ())
+		{
+			return;
+		}
+
+		if (_results[0] && _ampE.isFinished ())
+		{
+			emitStationAmplitude (0, true);
+		}
+		else if (_results[1] && _ampN.isFinished ())
+		{
+			emitStationAmplitude (1, true);
+		}
+	}
+
+	// Emits the sum of the horizontal result idx and Z
+	void
+	emitStationAmplitude (int idx, bool preliminary)
+	{
+		Result newRes;
+		newRes.record = _lastRecord.get ();
+		newRes.component = Any;
+		newRes.amplitude = summ (_results[idx]->value, _results[2]->value);
+		newRes.time = average (_results[idx]->time, _results[2]->time);
+		newRes.period = -1;
+		newRes.snr = -1;
+
+		if (preliminary)
+		{
+			_provisionalEmitted = true;
+			SEISCOMP_DEBUG ("Preliminary amplitude without %s component",
+			                idx == 0 ? "N" : "E");
+		}
+		_preliminary = preliminary;
+
+		KCLASS_STAT_SINCE (TriggerToEmit, _triggerClock);
+		emitAmplitude (newRes);
 	}
 
 	struct ComponentResult
 	{
 		AmplitudeValue value;
 		AmplitudeTime time;
+		RecordCPtr record;
+	};
+
+	// Samples of one component in fused filter mode
+	struct FusedLane
+	{
+		struct Run
+		{
+			size_t start;
+			double fsamp;
+		};
+
+		std::vector<double> samples; // filtered samples of the records
+		std::vector<size_t> offsets; // start of each record, then the end
+		std::vector<Run> runs;       // filter restarts, then the end
+		double fsamp{0};             // of the last record, 0 to restart
+		Core::Time end;              // of the last record
+	};
+
+	// Last result of a component and the inputs it was computed from
+	struct ComponentMemo
+	{
+		bool valid{false};
+		WindowKey key;
+		ComponentResult result;
 	};
 
 	mutable SimpleAmplitudeProcessor _ampE, _ampN, _ampZ;
 	OPT (ComponentResult)
 	_results[3];
+	ComponentMemo _memo[3];
+	OPT (double) _searchBegin, _searchEnd;
+	uint64_t _reprocessCount{0};
+	uint64_t _recomputeCount{0};
+	RecordCPtr _lastRecord;
+	bool _incremental{false};
+	bool _parallel{false};
+	bool _collecting{false};
+	bool _provisional{false};
+	bool _provisionalEmitted{false};
+	bool _preliminary{false};
+	std::mutex _resultMutex;
+	KClass::ChannelMap _channels;
+	bool _channelsResolved{false};
+	bool _fused{false};
+	KClass::WoodAndersonFilter _fusedFilter;
+	KClass::WoodAndersonResponse _waResponse;
+	FusedLane _fusedLanes[3];
+	std::vector<const Record *> _fusedStreams[3];
+	std::vector<RecordCPtr> _fusedPending[3];
+#ifdef K_CLASS_STATISTICS
+	KClass::Statistics::Clock::time_point _triggerClock;
+#endif
 };
 
-class MagnitudeProcessor_K_Class : public Processing::MagnitudeProcessor
+// Coefficients read from the configuration. Instances are immutable once
+// published so that magnitude computations can use them without locking.
+struct Coefficients
 {
-
-  public:
 	double A, a1, a2, a3, a4;
 	double b1, b2, b3, b4;
 	double l1, l2, l3;
 
+	KClass::Calibration calibration;
+	// Shared by the processors of all stations using the same file and
+	// regions, null without calibration regions
+	std::shared_ptr<const KClass::RegionIndex> regions;
+	std::vector<KClass::Calibration> regionCalibrations;
+	bool regionAtStation{false};
+
+	// Calibration of the region containing the epicenter or the station,
+	// the global calibration outside of all regions
+	const KClass::Calibration &
+	select (
+		const DataModel::Origin *hypocenter,
+		const DataModel::SensorLocation *receiver) const
+	{
+		if (!regions || regions->size () == 0)
+		{
+			return calibration;
+		}
+
+		int region = -1;
+		try {
+			if (regionAtStation && receiver)
+			{
+				region = regions->find (receiver->latitude (), receiver->longitude ());
+			}
+			else if (!regionAtStation && hypocenter)
+			{
+				region = regions->find (hypocenter->latitude ().value (),
+				                         hypocenter->longitude ().value ());
+			}
+		}
+		catch ( ... ) {}
+
+		return region >= 0 ? regionCalibrations[region] : calibration;
+	}
+};
+
+class MagnitudeProcessor_K_Class : public Processing::MagnitudeProcessor
+{
+
   public:
 	MagnitudeProcessor_K_Class ()
 		: Processing::MagnitudeProcessor (MAG_TYPE){}
 
+	~MagnitudeProcessor_K_Class () override
+	{
+		if (_reload)
+		{
+			KClass::ConfigReloader::Remove (this);
+		}
+	}
+
 	string
 	amplitudeType () const override
 	{
@@ -624,140 +1703,400 @@ class MagnitudeProcessor_K_Class : public Processing::MagnitudeProcessor
 		// TODO: ?Sanity check of the settings?
 		// TODO: ?Fully customizable distances using the array?
 		Processing::MagnitudeProcessor::setup(settings);
+
+		std::unique_ptr<Coefficients> c (new Coefficients);
+		if (!readCoefficients (settings, *c))
+		{
+			return false;
+		}
+		_coefficients.publish (std::move (c));
+
+		double reloadInterval = 0;
+		try {
+			reloadInterval = settings.getDouble ("magnitudes.K_Class.reloadInterval");
+		}
+		catch ( ... ) {}
+
+		KClass::ConfigReloader::Start (this, reloadInterval);
+		if (reloadInterval > 0 && !_reload)
+		{
+			_module = settings.module;
+			_networkCode = settings.networkCode;
+			_stationCode = settings.stationCode;
+			_locationCode = settings.locationCode;
+			_channelCode = settings.channelCode;
+			_keyParameters = settings.keyParameters;
+			_reload = true;
+			KClass::ConfigReloader::Add (this, [this] (const Config::Config &config) {
+				reload (config);
+			});
+		}
+
+		return true;
+	}
+
+	Processing::MagnitudeProcessor::Status
+	computeMagnitude (
+		double amplitude, const std::string &unit, double period,
+		double snr, double delta, double depth, const DataModel::Origin *hypocenter,
+		const DataModel::SensorLocation *receiver, const DataModel::Amplitude *,
+		const Locale *, double &value) override
+	{	
+		SEISCOMP_DEBUG("Delta = %f", delta);
+		Published::Reader c (_coefficients);
+		if (!c.get ())
+		{
+			return Error;
+		}
+
+		return compute_K_Class (
+			c->select (hypocenter, receiver), amplitude, delta, depth, &value);
+	}
+
+  private:
+	static Status
+	toStatus (KClass::Status status)
+	{
+		switch (status)
+		{
+		case KClass::OK:
+			return OK;
+		case KClass::DistanceOutOfRange:
+			return DistanceOutOfRange;
+		case KClass::DepthOutOfRange:
+			return DepthOutOfRange;
+		default:
+			break;
+		}
+
+		return Error;
+	}
+
+	static bool
+	readCoefficients (const Processing::Settings &settings, Coefficients &c)
+	{
+		std::string name;
+		try {
+			name = settings.getString ("magnitudes.K_Class.profile");
+		}
+		catch ( ... ) {}
+
+		if (!name.empty ())
+		{
+			return readProfile (settings, name, c);
+		}
+
 		try {
-			l1 = settings.getDouble ("magnitudes.K_Class.l1");
+			c.l1 = settings.getDouble ("magnitudes.K_Class.l1");
 		}
 		catch ( ... ) {
-			l1 = 75.0;
+			c.l1 = 75.0;
 		}
 		try {
-			l2 = settings.getDouble ("magnitudes.K_Class.l2");
+			c.l2 = settings.getDouble ("magnitudes.K_Class.l2");
 		}
 		catch ( ... ) {
-			l2 = 264.0;
+			c.l2 = 264.0;
 		}
 		try {
-			l3 = settings.getDouble ("magnitudes.K_Class.l3");
+			c.l3 = settings.getDouble ("magnitudes.K_Class.l3");
 		}
 		catch ( ... ) {
-			l3 = 800.0;
+			c.l3 = 800.0;
 		}
 		try {
-			A = settings.getDouble ("magnitudes.K_Class.A");
+			c.A = settings.getDouble ("magnitudes.K_Class.A");
 		}
 		catch ( ... ) {
-			A = 1.84;
+			c.A = 1.84;
 		}
 		try {
-			a1 = settings.getDouble ("magnitudes.K_Class.a1");
+			c.a1 = settings.getDouble ("magnitudes.K_Class.a1");
 		}
 		catch ( ... ) {
-			a1 = 2.11;
+			c.a1 = 2.11;
 		}
 		try {
-			a2 = settings.getDouble ("magnitudes.K_Class.a2");
+			c.a2 = settings.getDouble ("magnitudes.K_Class.a2");
 		}
 		catch ( ... ) {
-			a2 = 1.1;
+			c.a2 = 1.1;
 		}
 		try {
-			a3 = settings.getDouble ("magnitudes.K_Class.a3");
+			c.a3 = settings.getDouble ("magnitudes.K_Class.a3");
 		}
 		catch ( ... ) {
-			a3 = 2.98;
+			c.a3 = 2.98;
 		}
 		try {
-			a4 = settings.getDouble ("magnitudes.K_Class.a4");
+			c.a4 = settings.getDouble ("magnitudes.K_Class.a4");
 		}
 		catch ( ... ) {
-			a4 = 0.0;
+			c.a4 = 0.0;
 		}
 		try {
-			b1 = settings.getDouble ("magnitudes.K_Class.b1");
+			c.b1 = settings.getDouble ("magnitudes.K_Class.b1");
 		}
 		catch ( ... ) {
-			b1 = 1.32;
+			c.b1 = 1.32;
 		}
 		try {
-			b2 = settings.getDouble ("magnitudes.K_Class.b2");
+			c.b2 = settings.getDouble ("magnitudes.K_Class.b2");
 		}
 		catch ( ... ) {
-			b2 = 3.21;
+			c.b2 = 3.21;
 		}
 		try {
-			b3 = settings.getDouble ("magnitudes.K_Class.b3");
+			c.b3 = settings.getDouble ("magnitudes.K_Class.b3");
 		}
 		catch ( ... ) {
-			b3 = -1.34;
+			c.b3 = -1.34;
 		}
 		try {
-			b4 = settings.getDouble ("magnitudes.K_Class.b4");
+			c.b4 = settings.getDouble ("magnitudes.K_Class.b4");
 		}
 		catch ( ... ) {
-			b4 = 8.0;
+			c.b4 = 8.0;
 		}
-		return true;
-	}
 
+		// An explicit segment table replaces the four default segments
+		// A list parameter, one segment per element
+		std::vector<KClass::Calibration::Segment> segments;
+		std::vector<std::string> table;
+		if (!settings.getValue (table, "magnitudes.K_Class.segments"))
+		{
+			table.clear ();
+		}
 
-	Processing::MagnitudeProcessor::Status
-	computeMagnitude (
-		double amplitude, const std::string &unit, double period,
-		double snr, double delta, double depth, const DataModel::Origin *,
-		const DataModel::SensorLocation *, const DataModel::Amplitude *,
-		const Locale *, double &value) override
-	{	
-		SEISCOMP_DEBUG("Delta = %f", delta);
-		if ((delta < DELTA_MIN)|| (delta > DELTA_MAX))
+		if (table.empty ())
 		{
-			return DistanceOutOfRange;
+			segments = {{c.l1, c.a1, c.b1}, {c.l2, c.a2, c.b2}, {c.l3, c.a3, c.b3},
+			            {INFINITY, c.a4, c.b4}};
+		}
+		else if (!KClass::Calibration::ParseSegments (table, segments))
+		{
+			SEISCOMP_ERROR ("magnitudes.K_Class.segments: invalid entry in '%s'",
+			                joinList (table).c_str ());
+			return false;
 		}
 
-		if (depth > DEPTH_MAX)
+		if (!c.calibration.set (c.A, segments))
 		{
-			return DepthOutOfRange;
+			SEISCOMP_ERROR ("K_Class calibration: corner distances must be increasing");
+			return false;
 		}
 
-		return compute_K_Class (amplitude, delta, depth, &value);
+		return readRegions (settings, table, c);
 	}
 
-  private:
-	MagnitudeProcessor::Status
-	compute_K_Class (
-		double amplitude, double delta, double depth, double *mag)
+	// Uses the built-in calibration profile of that name. The individual
+	// coefficients and segments are ignored, calibration regions inherit the
+	// profile.
+	static bool
+	readProfile (
+		const Processing::Settings &settings, const std::string &name,
+		Coefficients &c)
 	{
-		float epDistKm, hypDistKm, magCalc;
+		const KClass::Profile *profile = KClass::findProfile (name);
+		if (!profile)
+		{
+			SEISCOMP_ERROR ("magnitudes.K_Class.profile: unknown profile '%s', "
+			                "expected one of %s", name.c_str (),
+			                KClass::profileNames ().c_str ());
+			return false;
+		}
+
+		c.calibration.set (*profile);
+		c.A = profile->A;
 
-		if (amplitude <= 0.)
+		std::vector<std::string> table;
+		const KClass::Calibration::Segment *segments = profile->segments;
+		if (profile->segmentCount == 4)
 		{
-			*mag = 0;
-			return Error;
+			c.l1 = segments[0].upper;
+			c.l2 = segments[1].upper;
+			c.l3 = segments[2].upper;
+			c.a1 = segments[0].slope;
+			c.a2 = segments[1].slope;
+			c.a3 = segments[2].slope;
+			c.a4 = segments[3].slope;
+			c.b1 = segments[0].intercept;
+			c.b2 = segments[1].intercept;
+			c.b3 = segments[2].intercept;
+			c.b4 = segments[3].intercept;
 		}
+		else
+		{
+			for (size_t i = 0; i < profile->segmentCount; ++i)
+			{
+				char entry[80];
+				if (i + 1 < profile->segmentCount)
+				{
+					snprintf (entry, sizeof (entry), "%.17g:%.17g:%.17g",
+					          segments[i].upper, segments[i].slope, segments[i].intercept);
+				}
+				else
+				{
+					snprintf (entry, sizeof (entry), "%.17g:%.17g",
+					          segments[i].slope, segments[i].intercept);
+				}
+				table.push_back (entry);
+			}
+		}
+
+		SEISCOMP_DEBUG ("K_Class calibration profile %s", profile->name);
+		return readRegions (settings, table, c);
+	}
+
+	// Reads the calibration regions of magnitudes.K_Class.calibrationRegionFile.
+	// Each region inherits the global coefficients and may override them with
+	// magnitudes.K_Class.calibrationRegion.<name>.<coefficient>.
+	static bool
+	readRegions (
+		const Processing::Settings &settings, const std::vector<std::string> &globalTable,
+		Coefficients &c)
+	{
+		std::string file;
+		try {
+			file = settings.getString ("magnitudes.K_Class.calibrationRegionFile");
+		}
+		catch ( ... ) {}
 
-		epDistKm = Math::Geo::deg2km (delta);
-		hypDistKm = sqrt (epDistKm * epDistKm + depth * depth);
-		if (hypDistKm <= l1)
+		if (file.empty ())
 		{
-			magCalc = A * (log10 (amplitude) + a1 * log10 (hypDistKm) + b1);
+			return true;
 		}
-		else if (hypDistKm > l1 && hypDistKm <= l2)
+
+		std::string location = "epicenter";
+		try {
+			location = settings.getString ("magnitudes.K_Class.calibrationRegionLocation");
+		}
+		catch ( ... ) {}
+
+		if (location == "station")
 		{
-			magCalc = A * (log10 (amplitude) + a2 * log10 (hypDistKm) + b2);
+			c.regionAtStation = true;
 		}
-		else if (hypDistKm > l2 && hypDistKm <= l3)
+		else if (location != "epicenter")
 		{
-			magCalc = A * (log10 (amplitude) + a3 * log10 (hypDistKm) + b3);
+			SEISCOMP_ERROR ("magnitudes.K_Class.calibrationRegionLocation: "
+			                "expected epicenter or station, got '%s'", location.c_str ());
+			return false;
 		}
-		else
+
+		std::shared_ptr<const KClass::RegionFile> regionFile = KClass::RegionPool::Read (file);
+		if (!regionFile)
 		{
-			magCalc = A * (log10 (amplitude) + a4 * log10 (hypDistKm) + b4);
+			SEISCOMP_ERROR ("magnitudes.K_Class.calibrationRegionFile: "
+			                "failed to read '%s'", file.c_str ());
+			return false;
+		}
 
+		std::vector<size_t> selected;
+		for (size_t r = 0; r < regionFile->names.size (); ++r)
+		{
+			const std::string &region = regionFile->names[r];
+			std::string prefix = "magnitudes.K_Class.calibrationRegion." + region + ".";
+			bool enable = true;
+			try {
+				enable = settings.getBool (prefix + "enable");
+			}
+			catch ( ... ) {}
+
+			if (!enable)
+			{
+				continue;
+			}
+
+			auto value = [&] (const char *name, double global) {
+				try {
+					return settings.getDouble (prefix + name);
+				}
+				catch ( ... ) {
+					return global;
+				}
+			};
+
+			std::vector<std::string> table;
+			if (!settings.getValue (table, prefix + "segments"))
+			{
+				table = globalTable;
+			}
+
+			std::vector<KClass::Calibration::Segment> segments;
+			if (table.empty ())
+			{
+				segments = {{value ("l1", c.l1), value ("a1", c.a1), value ("b1", c.b1)},
+				            {value ("l2", c.l2), value ("a2", c.a2), value ("b2", c.b2)},
+				            {value ("l3", c.l3), value ("a3", c.a3), value ("b3", c.b3)},
+				            {INFINITY, value ("a4", c.a4), value ("b4", c.b4)}};
+			}
+			else if (!KClass::Calibration::ParseSegments (table, segments))
+			{
+				SEISCOMP_ERROR ("%ssegments: invalid entry in '%s'",
+				                prefix.c_str (), joinList (table).c_str ());
+				return false;
+			}
+
+			KClass::Calibration regionCalibration;
+			if (!regionCalibration.set (value ("A", c.A), segments))
+			{
+				SEISCOMP_ERROR ("K_Class calibration of region %s: corner distances "
+				                "must be increasing", region.c_str ());
+				return false;
+			}
+
+			selected.push_back (r);
+			c.regionCalibrations.push_back (regionCalibration);
+		}
+
+		// The polygons and the index are shared with the processors of the
+		// other stations
+		c.regions = KClass::RegionPool::Index (regionFile, selected);
+		SEISCOMP_INFO ("K_Class: %zu calibration regions selected by %s location",
+		               c.regions->size (), location.c_str ());
+		return true;
+	}
+
+	// Called from the reloader thread with the changed configuration. The
+	// new coefficients are complete before they are published, computations
+	// running meanwhile finish with the old ones.
+	void
+	reload (const Config::Config &config)
+	{
+		Processing::Settings settings (
+			_module, _networkCode, _stationCode, _locationCode, _channelCode,
+			&config, _keyParameters.get ());
+
+		std::unique_ptr<Coefficients> c (new Coefficients);
+		if (!readCoefficients (settings, *c))
+		{
+			SEISCOMP_WARNING ("K_Class: invalid coefficients for %s.%s, keeping the "
+			                  "current ones", _networkCode.c_str (), _stationCode.c_str ());
+			return;
 		}
 
-			*mag = magCalc;
+		_coefficients.publish (std::move (c));
+	}
 
-		return OK;
+	MagnitudeProcessor::Status
+	compute_K_Class (
+		const KClass::Calibration &calibration,
+		double amplitude, double delta, double depth, double *mag)
+	{
+		return toStatus (KClass::computeMagnitude (
+			calibration, amplitude, delta, depth, *mag));
 	}
+
+	// Identity of the station for rereading the configuration
+	std::string _module, _networkCode, _stationCode, _locationCode, _channelCode;
+	Util::KeyValuesCPtr _keyParameters;
+	bool _reload{false};
+
+	// Current coefficients, replaced as a whole on reload. Computations pin
+	// them with a Published::Reader, which does not allocate.
+	typedef KClass::Published<Coefficients> Published;
+	Published _coefficients;
 };
 
 REGISTER_AMPLITUDEPROCESSOR (AmplitudeProcessor_K_Class, MAG_TYPE);
@@ -0,0 +1,505 @@
+#include "absmax.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define K_CLASS_ABSMAX_X86
+#include <immintrin.h>
+#endif
+
+
+namespace KClass
+{
+
+namespace
+{
+
+// The vectorized versions work in two passes: first the maximum value is
+// determined, then the first sample reaching it. This gives the same index as
+// the scalar loop which only moves on a strictly larger value. The maximum is
+// always accumulated as max(sample, acc) so that NaN samples never replace
+// the accumulator, as in the scalar comparison.
+
+int
+absmax_scalar (const double *f, int i1, int i2, double offset)
+{
+	int imax = i1;
+	double amax = std::fabs (f[i1] - offset);
+	for (int i = i1 + 1; i < i2; ++i)
+	{
+		double a = std::fabs (f[i] - offset);
+		if (a > amax)
+		{
+			amax = a;
+			imax = i;
+		}
+	}
+	return imax;
+}
+
+
+#ifdef K_CLASS_ABSMAX_X86
+
+#ifdef __SSE2__
+int
+absmax_sse2 (const double *f, int i1, int i2, double offset)
+{
+	double first = std::fabs (f[i1] - offset);
+	if (std::isnan (first))
+	{
+		return i1;
+	}
+
+	const __m128d sign = _mm_set1_pd (-0.0);
+	const __m128d off = _mm_set1_pd (offset);
+
+	__m128d acc = _mm_set1_pd (first);
+	int i = i1;
+	for (; i + 2 <= i2; i += 2)
+	{
+		__m128d v = _mm_andnot_pd (sign, _mm_sub_pd (_mm_loadu_pd (f + i), off));
+		acc = _mm_max_pd (v, acc);
+	}
+
+	double lanes[2];
+	_mm_storeu_pd (lanes, acc);
+	double amax = lanes[1] > lanes[0] ? lanes[1] : lanes[0];
+	for (; i < i2; ++i)
+	{
+		double a = std::fabs (f[i] - offset);
+		if (a > amax)
+		{
+			amax = a;
+		}
+	}
+
+	const __m128d target = _mm_set1_pd (amax);
+	for (i = i1; i + 2 <= i2; i += 2)
+	{
+		__m128d v = _mm_andnot_pd (sign, _mm_sub_pd (_mm_loadu_pd (f + i), off));
+		int mask = _mm_movemask_pd (_mm_cmpeq_pd (v, target));
+		if (mask)
+		{
+			return i + __builtin_ctz (mask);
+		}
+	}
+	for (; i < i2; ++i)
+	{
+		if (std::fabs (f[i] - offset) == amax)
+		{
+			return i;
+		}
+	}
+
+	return i1;
+}
+#endif
+
+
+__attribute__ ((target ("avx"))) int
+absmax_avx (const double *f, int i1, int i2, double offset)
+{
+	double first = std::fabs (f[i1] - offset);
+	if (std::isnan (first))
+	{
+		return i1;
+	}
+
+	const __m256d sign = _mm256_set1_pd (-0.0);
+	const __m256d off = _mm256_set1_pd (offset);
+
+	__m256d acc0 = _mm256_set1_pd (first);
+	__m256d acc1 = acc0;
+	int i = i1;
+	for (; i + 8 <= i2; i += 8)
+	{
+		__m256d v0 = _mm256_andnot_pd (sign, _mm256_sub_pd (_mm256_loadu_pd (f + i), off));
+		__m256d v1 = _mm256_andnot_pd (sign, _mm256_sub_pd (_mm256_loadu_pd (f + i + 4), off));
+		acc0 = _mm256_max_pd (v0, acc0);
+		acc1 = _mm256_max_pd (v1, acc1);
+	}
+	acc0 = _mm256_max_pd (acc1, acc0);
+
+	double lanes[4];
+	_mm256_storeu_pd (lanes, acc0);
+	double amax = lanes[0];
+	for (int k = 1; k < 4; ++k)
+	{
+		if (lanes[k] > amax)
+		{
+			amax = lanes[k];
+		}
+	}
+	for (; i < i2; ++i)
+	{
+		double a = std::fabs (f[i] - offset);
+		if (a > amax)
+		{
+			amax = a;
+		}
+	}
+
+	const __m256d target = _mm256_set1_pd (amax);
+	for (i = i1; i + 4 <= i2; i += 4)
+	{
+		__m256d v = _mm256_andnot_pd (sign, _mm256_sub_pd (_mm256_loadu_pd (f + i), off));
+		int mask = _mm256_movemask_pd (_mm256_cmp_pd (v, target, _CMP_EQ_OQ));
+		if (mask)
+		{
+			return i + __builtin_ctz (mask);
+		}
+	}
+	for (; i < i2; ++i)
+	{
+		if (std::fabs (f[i] - offset) == amax)
+		{
+			return i;
+		}
+	}
+
+	return i1;
+}
+
+#endif
+
+
+typedef int (*AbsMaxFunc) (const double *, int, int, double);
+
+struct Implementation
+{
+	AbsMaxFunc func;
+	const char *name;
+};
+
+Implementation
+select ()
+{
+#ifdef K_CLASS_ABSMAX_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx"))
+	{
+		return {absmax_avx, "avx"};
+	}
+#ifdef __SSE2__
+	return {absmax_sse2, "sse2"};
+#endif
+#endif
+	return {absmax_scalar, "scalar"};
+}
+
+const Implementation &
+implementation ()
+{
+	static const Implementation impl = select ();
+	return impl;
+}
+
+} // namespace
+
+
+int
+find_absmax (int n, const double *f, int i1, int i2, double offset)
+{
+	if (i2 > n)
+	{
+		i2 = n;
+	}
+	if (i1 < 0)
+	{
+		i1 = 0;
+	}
+	if (i1 >= i2)
+	{
+		return i1;
+	}
+
+	return implementation ().func (f, i1, i2, offset);
+}
+
+
+const char *
+find_absmax_implementation ()
+{
+	return implementation ().name;
+}
+
+
+int
+PeakTracker::update (int n, const double *f, int i1, int i2, double offset)
+{
+	if (i2 > n)
+	{
+		i2 = n;
+	}
+	if (i1 < 0)
+	{
+		i1 = 0;
+	}
+	if (i1 >= i2)
+	{
+		_valid = false;
+		return i1;
+	}
+
+	// The last check guards against the buffer having been refilled
+	if (_valid && i1 == _begin && i2 >= _end && offset == _offset &&
+	    _index < n && std::fabs (f[_index] - offset) == _value)
+	{
+		if (i2 > _end)
+		{
+			int j = find_absmax (n, f, _end, i2, offset);
+			double a = std::fabs (f[j] - offset);
+			if (std::isnan (a))
+			{
+				// A leading NaN hides the maximum of the new samples
+				_valid = false;
+			}
+			else
+			{
+				_scanned += i2 - _end;
+				_end = i2;
+				if (a > _value)
+				{
+					_value = a;
+					_index = j;
+				}
+				return _index;
+			}
+		}
+		else
+		{
+			return _index;
+		}
+	}
+
+	_index = find_absmax (n, f, i1, i2, offset);
+	_value = std::fabs (f[_index] - offset);
+	_begin = i1;
+	_end = i2;
+	_offset = offset;
+	_scanned += i2 - i1;
+	_valid = true;
+
+	return _index;
+}
+
+
+
+void
+RangeAbsMax::build (int n, const double *f, double offset)
+{
+	_data = f;
+	_n = n;
+	_offset = offset;
+	_blocks = (n + BlockSize - 1) / BlockSize;
+	fingerprint (f, _fingerprint);
+
+	int levels = 1;
+	while ((1 << levels) <= _blocks)
+	{
+		++levels;
+	}
+	_table.assign (static_cast<size_t> (levels) * _blocks, -1);
+
+	for (int b = 0; b < _blocks; ++b)
+	{
+		int end = std::min (n, (b + 1) * BlockSize);
+		int imax = -1;
+		double amax = -1;
+		for (int i = b * BlockSize; i < end; ++i)
+		{
+			double a = std::fabs (f[i] - offset);
+			if (a > amax)
+			{
+				amax = a;
+				imax = i;
+			}
+		}
+		_table[b] = imax;
+	}
+
+	for (int k = 1; k < levels; ++k)
+	{
+		int *row = &_table[static_cast<size_t> (k) * _blocks];
+		const int *prev = row - _blocks;
+		int half = 1 << (k - 1);
+		for (int b = 0; b + (1 << k) <= _blocks; ++b)
+		{
+			row[b] = better (f, prev[b], prev[b + half]);
+		}
+	}
+}
+
+
+void
+RangeAbsMax::clear ()
+{
+	_data = nullptr;
+	_n = _blocks = 0;
+	// Keep the capacity, the index of the next origin has about the same
+	// size and is then built without allocating
+	_table.clear ();
+}
+
+
+bool
+RangeAbsMax::matches (int n, const double *f, double offset) const
+{
+	if (!_data || f != _data || n != _n || offset != _offset)
+	{
+		return false;
+	}
+
+	double values[FingerprintSize];
+	fingerprint (f, values);
+	for (int i = 0; i < FingerprintSize; ++i)
+	{
+		// Bitwise so that NaN samples compare equal
+		if (memcmp (&values[i], &_fingerprint[i], sizeof (double)) != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+int
+RangeAbsMax::query (const double *f, int i1, int i2) const
+{
+	if (i2 > _n)
+	{
+		i2 = _n;
+	}
+	if (i1 < 0)
+	{
+		i1 = 0;
+	}
+	if (i1 >= i2 || std::isnan (f[i1] - _offset))
+	{
+		return i1;
+	}
+
+	int b1 = (i1 + BlockSize - 1) / BlockSize;
+	int b2 = i2 / BlockSize;
+	if (b1 >= b2)
+	{
+		return find_absmax (_n, f, i1, i2, _offset);
+	}
+
+	// Left edge, full blocks and right edge in this order, so the earlier
+	// sample wins ties
+	int imax = i1;
+	double amax = std::fabs (f[i1] - _offset);
+	for (int i = i1 + 1; i < b1 * BlockSize; ++i)
+	{
+		double a = std::fabs (f[i] - _offset);
+		if (a > amax)
+		{
+			amax = a;
+			imax = i;
+		}
+	}
+
+	int ib = peak (f, b1, b2);
+	if (ib >= 0)
+	{
+		double a = std::fabs (f[ib] - _offset);
+		if (a > amax)
+		{
+			amax = a;
+			imax = ib;
+		}
+	}
+
+	for (int i = b2 * BlockSize; i < i2; ++i)
+	{
+		double a = std::fabs (f[i] - _offset);
+		if (a > amax)
+		{
+			amax = a;
+			imax = i;
+		}
+	}
+
+	return imax;
+}
+
+
+int
+RangeAbsMax::peak (const double *f, int b1, int b2) const
+{
+	int k = 0;
+	while ((2 << k) <= b2 - b1)
+	{
+		++k;
+	}
+	const int *row = &_table[static_cast<size_t> (k) * _blocks];
+	return better (f, row[b1], row[b2 - (1 << k)]);
+}
+
+
+int
+RangeAbsMax::better (const double *f, int a, int b) const
+{
+	// a precedes b, so it is kept on ties
+	if (a < 0)
+	{
+		return b;
+	}
+	if (b < 0)
+	{
+		return a;
+	}
+	return std::fabs (f[b] - _offset) > std::fabs (f[a] - _offset) ? b : a;
+}
+
+
+void
+RangeAbsMax::fingerprint (const double *f, double *values) const
+{
+	for (int i = 0; i < FingerprintSize; ++i)
+	{
+		values[i] = _n > 0 ? f[static_cast<long> (_n - 1) * i / (FingerprintSize - 1)] : 0.0;
+	}
+}
+
+
+void
+PeakSearch::reset ()
+{
+	_peak.reset ();
+	_rangeMax.clear ();
+	_lastSize = -1;
+}
+
+
+int
+PeakSearch::find (int n, const double *f, int i1, int i2, double offset)
+{
+	int index;
+	if (_rangeMax.matches (n, f, offset))
+	{
+		_method = RangeIndex;
+		index = _rangeMax.query (f, i1, i2);
+	}
+	else if (n == _lastSize)
+	{
+		_method = RangeBuild;
+		_rangeMax.build (n, f, offset);
+		index = _rangeMax.query (f, i1, i2);
+	}
+	else
+	{
+		_method = Tracker;
+		index = _peak.update (n, f, i1, i2, offset);
+	}
+
+	_lastSize = n;
+	return index;
+}
+
+} // namespace KClass
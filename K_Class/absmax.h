@@ -0,0 +1,113 @@
+// Vectorized absolute maximum search
+
+#ifndef __K_Class_ABSMAX_H__
+#define __K_Class_ABSMAX_H__
+
+
+#include <vector>
+
+namespace KClass
+{
+
+// Drop-in replacement of Seiscomp's find_absmax: returns the index of the
+// first sample in [i1, i2) with the largest |f[i] - offset|. i2 is clipped to
+// n. Ties and NaN samples are handled exactly like the scalar version. The
+// implementation is selected once at runtime (AVX, SSE2 or scalar).
+int find_absmax (int n, const double *f, int i1, int i2, double offset);
+
+// Name of the selected implementation, for logging
+const char *find_absmax_implementation ();
+
+// Running absolute maximum over a growing window [i1, i2) of a growing
+// buffer. As long as the window start and offset stay the same, update only
+// scans the samples appended since the previous call, otherwise it falls back
+// to a full search. Results are identical to find_absmax.
+class PeakTracker
+{
+  public:
+	void reset () { _valid = false; }
+
+	int update (int n, const double *f, int i1, int i2, double offset);
+
+	// Total number of samples searched so far
+	unsigned long scanned () const { return _scanned; }
+
+  private:
+	bool _valid{false};
+	int _begin{0};
+	int _end{0};
+	int _index{0};
+	double _value{0};
+	double _offset{0};
+	unsigned long _scanned{0};
+};
+
+// Range absolute maximum index over a complete buffer. The buffer is split
+// into blocks whose peaks are kept in a sparse table, so that a query only
+// scans the two partial blocks at the window edges. Used to answer repeated
+// searches with different windows (reprocessing) without rescanning. Results
+// are identical to find_absmax.
+class RangeAbsMax
+{
+  public:
+	static constexpr int BlockSize = 128;
+
+	void build (int n, const double *f, double offset);
+	void clear ();
+
+	// Whether the index was built for this buffer and offset. Besides the
+	// size and address a few samples are compared to detect a refill.
+	bool matches (int n, const double *f, double offset) const;
+
+	int query (const double *f, int i1, int i2) const;
+
+  private:
+	// Index of the first largest sample in a block range, -1 if only NaN
+	int peak (const double *f, int b1, int b2) const;
+	int better (const double *f, int a, int b) const;
+	void fingerprint (const double *f, double *values) const;
+
+	static constexpr int FingerprintSize = 8;
+
+	const double *_data{nullptr};
+	int _n{0};
+	int _blocks{0};
+	double _offset{0};
+	double _fingerprint[FingerprintSize];
+	// _table[k * _blocks + b] is the peak of blocks [b, b + 2^k)
+	std::vector<int> _table;
+};
+
+// Peak search strategy of one component. Searches in a buffer that grows
+// go through the PeakTracker. A search without new data (reprocessing)
+// builds the RangeAbsMax index, which answers all later searches until the
+// buffer changes.
+class PeakSearch
+{
+  public:
+	enum Method
+	{
+		Tracker,
+		RangeBuild,
+		RangeIndex
+	};
+
+	void reset ();
+
+	int find (int n, const double *f, int i1, int i2, double offset);
+
+	// Method used by the last call of find
+	Method method () const { return _method; }
+
+	unsigned long scanned () const { return _peak.scanned (); }
+
+  private:
+	PeakTracker _peak;
+	RangeAbsMax _rangeMax;
+	int _lastSize{-1};
+	Method _method{Tracker};
+};
+
+} // namespace KClass
+
+#endif
@@ -0,0 +1,90 @@
+#include "amplitude.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace KClass
+{
+
+AmplitudeValue
+summ (const AmplitudeValue &v0, const AmplitudeValue &v1)
+{
+	AmplitudeValue v;
+	v.value = v0.value + v1.value;
+	v.lower = std::sqrt (v0.lower * v0.lower + v1.lower * v1.lower);
+	v.upper = std::sqrt (v0.upper * v0.upper + v1.upper * v1.upper);
+	return v;
+}
+
+
+AmplitudeTime
+average (const AmplitudeTime &t0, const AmplitudeTime &t1)
+{
+	AmplitudeTime t;
+	t.reference = (t0.reference + t1.reference) * 0.5;
+
+	double minTime = t.reference;
+	double maxTime = t.reference;
+	for (double time : {t0.reference + t0.begin, t0.reference + t0.end,
+	                    t1.reference + t1.begin, t1.reference + t1.end})
+	{
+		minTime = std::min (minTime, time);
+		maxTime = std::max (maxTime, time);
+	}
+
+	t.begin = minTime - t.reference;
+	t.end = maxTime - t.reference;
+
+	return t;
+}
+
+
+bool
+verticalWindow (
+	const FirstArrivals &arrivals, double triggerOffset, SignalWindow &window)
+{
+	if (!arrivals.haveP || !arrivals.haveS)
+	{
+		return false;
+	}
+
+	window.begin = arrivals.p - triggerOffset;
+	window.end = arrivals.s - triggerOffset;
+	return true;
+}
+
+
+size_t
+bufferCapacity (double windowLength, double samplingFrequency, size_t recordSamples)
+{
+	if (!(windowLength > 0) || !(samplingFrequency > 0))
+	{
+		return 0;
+	}
+	// Records overlapping either end of the window are stored completely
+	return static_cast<size_t> (std::ceil (windowLength * samplingFrequency)) + 1 +
+	       2 * recordSamples;
+}
+
+
+AmplitudeStatus
+peakAmplitude (double sample, double offset, double gain, double &amplitude)
+{
+	double peak = std::fabs (sample - offset);
+	if (peak <= 0)
+	{
+		return NoPeak;
+	}
+
+	if (gain == 0.0)
+	{
+		return ZeroGain;
+	}
+
+	// mm to μm conversion
+	amplitude = std::abs (peak / gain * 1E03);
+	return AmplitudeOK;
+}
+
+} // namespace KClass
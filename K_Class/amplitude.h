@@ -0,0 +1,71 @@
+// K_Class amplitude measurement independent of the SeisComP processors
+
+#ifndef __K_Class_AMPLITUDE_H__
+#define __K_Class_AMPLITUDE_H__
+
+
+#include "ttcache.h"
+
+#include <cstddef>
+
+
+namespace KClass
+{
+
+// Amplitude with uncertainties, a missing uncertainty is 0
+struct AmplitudeValue
+{
+	double value = 0.0;
+	double lower = 0.0;
+	double upper = 0.0;
+};
+
+// Reference time (s) and the begin and end of the measurement relative to it
+struct AmplitudeTime
+{
+	double reference = 0.0;
+	double begin = 0.0;
+	double end = 0.0;
+};
+
+// Signal window relative to the trigger (s)
+struct SignalWindow
+{
+	double begin = 0.0;
+	double end = 0.0;
+};
+
+// Sum of two component amplitudes, the uncertainties add in quadrature
+AmplitudeValue summ (const AmplitudeValue &v0, const AmplitudeValue &v1);
+
+// Mean reference time of two component amplitudes (from SED MLh). The
+// begin and end span both measurements.
+AmplitudeTime average (const AmplitudeTime &t0, const AmplitudeTime &t1);
+
+// Window of the vertical component from the first P to the first S arrival.
+// triggerOffset is the trigger time relative to the origin time. Returns
+// false if one of the phases is missing.
+bool
+verticalWindow (
+	const FirstArrivals &arrivals, double triggerOffset, SignalWindow &window);
+
+// Samples needed to buffer a time window (s) fed with records of
+// recordSamples samples. The first record may start up to one record
+// before the window and the last one end up to one record after it.
+size_t
+bufferCapacity (double windowLength, double samplingFrequency, size_t recordSamples);
+
+enum AmplitudeStatus
+{
+	AmplitudeOK,
+	NoPeak,
+	ZeroGain
+};
+
+// Converts the peak sample of a component into the amplitude in micrometers
+AmplitudeStatus
+peakAmplitude (double sample, double offset, double gain, double &amplitude);
+
+} // namespace KClass
+
+#endif
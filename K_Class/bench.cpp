@@ -0,0 +1,764 @@
+// Waveform replay benchmark of the K_Class amplitude processor
+//
+// Creates the processor through the amplitude processor factory and drives
+// it like scamp does: setup, setEnvironment, setTrigger, feed and reprocess
+// for every station of every origin. The records are either synthetic or
+// read from a record stream. Reports the record throughput, latency
+// percentiles and heap allocations of each stage and the peak resident set
+// size. Exits with a non-zero status if one of the processor checks fails.
+// With --fused the first stations of the first origin are also replayed
+// with the per-component filters, their amplitudes must agree. The
+// allocations of the warmed up per-station path are checked by
+// kclass-plugin-test.
+
+#include "magnitude.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <seiscomp/config/config.h>
+#include <seiscomp/core/genericrecord.h>
+#include <seiscomp/core/typedarray.h>
+#include <seiscomp/datamodel/origin.h>
+#include <seiscomp/datamodel/pick.h>
+#include <seiscomp/datamodel/sensorlocation.h>
+#include <seiscomp/io/recordinput.h>
+#include <seiscomp/math/geo.h>
+#include <seiscomp/processing/amplitudeprocessor.h>
+#include <seiscomp/seismology/ttt.h>
+
+using namespace std;
+using namespace Seiscomp;
+
+
+namespace
+{
+
+// Heap allocations of all threads, counted by the replaced operator new
+atomic<uint64_t> allocations{0};
+
+int mismatches = 0;
+
+void
+check (bool ok, const char *what)
+{
+	if (!ok)
+	{
+		printf ("MISMATCH: %s\n", what);
+		++mismatches;
+	}
+}
+
+
+void *
+allocate (size_t size)
+{
+	allocations.fetch_add (1, memory_order_relaxed);
+	if (void *p = malloc (size ? size : 1))
+	{
+		return p;
+	}
+	throw bad_alloc ();
+}
+
+void *
+allocate (size_t size, align_val_t alignment)
+{
+	allocations.fetch_add (1, memory_order_relaxed);
+	size_t align = static_cast<size_t> (alignment);
+	if (void *p = aligned_alloc (align, (size + align - 1) / align * align))
+	{
+		return p;
+	}
+	throw bad_alloc ();
+}
+
+} // namespace
+
+
+// All forms are replaced, so that every delete frees memory of the
+// matching new
+void *operator new (size_t size) { return allocate (size); }
+void *operator new[] (size_t size) { return allocate (size); }
+void *operator new (size_t size, align_val_t align) { return allocate (size, align); }
+void *operator new[] (size_t size, align_val_t align) { return allocate (size, align); }
+void operator delete (void *p) noexcept { free (p); }
+void operator delete[] (void *p) noexcept { free (p); }
+void operator delete (void *p, size_t) noexcept { free (p); }
+void operator delete[] (void *p, size_t) noexcept { free (p); }
+void operator delete (void *p, align_val_t) noexcept { free (p); }
+void operator delete[] (void *p, align_val_t) noexcept { free (p); }
+void operator delete (void *p, size_t, align_val_t) noexcept { free (p); }
+void operator delete[] (void *p, size_t, align_val_t) noexcept { free (p); }
+
+
+namespace
+{
+
+// Travel times of a homogeneous half space, so that the benchmark needs no
+// travel-time tables. The model name is "vp/vs" in km/s.
+class FakeTravelTimeTable : public TravelTimeTableInterface
+{
+  public:
+	bool
+	setModel (const std::string &model) override
+	{
+		double vp, vs;
+		if (sscanf (model.c_str (), "%lf/%lf", &vp, &vs) == 2 && vp > 0 && vs > 0)
+		{
+			_vp = vp;
+			_vs = vs;
+		}
+		_model = model;
+		return true;
+	}
+
+	const std::string &model () const override { return _model; }
+
+	TravelTimeList *
+	compute (
+		double lat1, double lon1, double dep1, double lat2, double lon2,
+		double elev2 = 0., int ellc = 1) override
+	{
+		double r = distance (lat1, lon1, dep1, lat2, lon2, elev2);
+		TravelTimeList *list = new TravelTimeList;
+		list->push_back (TravelTime ("Pg", r / _vp, 0, 0, 0, 0));
+		list->push_back (TravelTime ("Sg", r / _vs, 0, 0, 0, 0));
+		list->sortByTime ();
+		return list;
+	}
+
+	TravelTime
+	compute (
+		const char *phase, double lat1, double lon1, double dep1, double lat2,
+		double lon2, double elev2 = 0., int ellc = 1) override
+	{
+		double r = distance (lat1, lon1, dep1, lat2, lon2, elev2);
+		double v = phase && phase[0] == 'S' ? _vs : _vp;
+		return TravelTime (phase ? phase : "Pg", r / v, 0, 0, 0, 0);
+	}
+
+	TravelTime
+	computeFirst (
+		double lat1, double lon1, double dep1, double lat2, double lon2,
+		double elev2 = 0., int ellc = 1) override
+	{
+		return compute ("Pg", lat1, lon1, dep1, lat2, lon2, elev2, ellc);
+	}
+
+  private:
+	static double
+	distance (double lat1, double lon1, double dep1, double lat2, double lon2, double elev2)
+	{
+		double delta, az, baz;
+		Math::Geo::delazi_wgs84 (lat1, lon1, lat2, lon2, &delta, &az, &baz);
+		double x = Math::Geo::deg2km (delta);
+		double z = dep1 + elev2 * 1E-3;
+		return std::sqrt (x * x + z * z);
+	}
+
+	std::string _model{"6/3.5"};
+	double _vp{6.0};
+	double _vs{3.5};
+};
+
+REGISTER_TRAVELTIME_TABLE (FakeTravelTimeTable, "kclass-fake");
+
+
+struct Options
+{
+	size_t stations = 100;
+	size_t origins = 5;
+	double samplingFrequency = 100.0;
+	double recordLength = 10.0;
+	string records;
+	string ttInterface = "kclass-fake";
+	string ttModel = "6/3.5";
+	bool incremental = false;
+	bool parallel = false;
+	bool grid = false;
+	bool fused = false;
+	bool layered = false;
+};
+
+const string ModuleName = "kclass-bench";
+
+// Three component stream set of one station
+struct Station
+{
+	string network, station, location;
+	string channels[3]; // Z, N, E
+	string band;        // channel code prefix of the settings
+	double latitude = 0, longitude = 0;
+	vector<RecordPtr> records; // file input only, in time order
+};
+
+// Stations of the first origin replayed with both filters in fused mode
+const size_t FusedChecks = 5;
+// Relative difference allowed between the fused and the per-component
+// amplitudes, which differ in the discretization and start of the filter
+const double FusedTolerance = 0.05;
+
+enum Stage
+{
+	Setup,
+	SetEnvironment,
+	SetTrigger,
+	Feed,
+	Reprocess,
+	StageCount
+};
+
+const char *StageNames[StageCount] = {"setup", "setEnvironment", "setTrigger", "feed", "reprocess"};
+
+typedef chrono::steady_clock Clock;
+
+double
+elapsed (Clock::time_point start)
+{
+	return chrono::duration<double, micro> (Clock::now () - start).count ();
+}
+
+void
+usage ()
+{
+	cerr << "Usage: kclass-bench [options]" << endl
+	     << endl
+	     << "Options:" << endl
+	     << "  --stations n         synthetic stations (default: 100)" << endl
+	     << "  --origins n          origins replayed for every station (default: 5)" << endl
+	     << "  --rate hz            synthetic sampling frequency (default: 100)" << endl
+	     << "  --record-length s    synthetic record length (default: 10)" << endl
+	     << "  --records url        replay the records of a record stream instead" << endl
+	     << "  --ttt interface:model  travel-time table (default: kclass-fake:6/3.5)" << endl
+	     << "  --layered            use the built-in layered model instead of the table" << endl
+	     << "  --incremental, --parallel, --grid, --fused" << endl
+	     << "                       enable the respective amplitudes.K_Class option" << endl;
+}
+
+bool
+parseOptions (int argc, char **argv, Options &opts)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (arg == "--incremental")
+			opts.incremental = true;
+		else if (arg == "--parallel")
+			opts.parallel = true;
+		else if (arg == "--grid")
+			opts.grid = true;
+		else if (arg == "--fused")
+			opts.fused = true;
+		else if (arg == "--layered")
+			opts.layered = true;
+		else if (i + 1 < argc)
+		{
+			string value = argv[++i];
+			double number = atof (value.c_str ());
+			if (arg == "--stations" && number >= 1)
+				opts.stations = static_cast<size_t> (number);
+			else if (arg == "--origins" && number >= 1)
+				opts.origins = static_cast<size_t> (number);
+			else if (arg == "--rate" && number > 0)
+				opts.samplingFrequency = number;
+			else if (arg == "--record-length" && number > 0)
+				opts.recordLength = number;
+			else if (arg == "--records")
+				opts.records = value;
+			else if (arg == "--ttt" && value.find (':') != string::npos)
+			{
+				opts.ttInterface = value.substr (0, value.find (':'));
+				opts.ttModel = value.substr (value.find (':') + 1);
+			}
+			else
+				return false;
+		}
+		else
+			return false;
+	}
+
+	return true;
+}
+
+// Places the stations on a spiral around the epicentres within the valid
+// distance range of the magnitude
+void
+placeStations (vector<Station> &stations, double lat, double lon)
+{
+	for (size_t i = 0; i < stations.size (); ++i)
+	{
+		double delta = 0.1 + (KClass::DeltaMax * 0.9 - 0.1) * (i + 0.5) / stations.size ();
+		double azimuth = fmod (i * 137.508, 360.0) * M_PI / 180;
+		stations[i].latitude = lat + delta * cos (azimuth);
+		stations[i].longitude = lon + delta * sin (azimuth) / cos (lat * M_PI / 180);
+	}
+}
+
+bool
+readStations (const string &url, vector<Station> &stations)
+{
+	IO::RecordStreamPtr rs = IO::RecordStream::Open (url.c_str ());
+	if (!rs)
+	{
+		cerr << "Unable to open " << url << endl;
+		return false;
+	}
+
+	map<string, size_t> index;
+	IO::RecordInput input (rs.get (), Array::DOUBLE, Record::DATA_ONLY);
+	for (IO::RecordIterator it = input.begin (); it != input.end (); ++it)
+	{
+		Record *rec = *it;
+		const string &cha = rec->channelCode ();
+		if (cha.size () != 3 || !rec->data ())
+		{
+			continue;
+		}
+
+		int comp;
+		switch (cha[2])
+		{
+		case 'Z':
+			comp = 0;
+			break;
+		case 'N':
+		case '1':
+			comp = 1;
+			break;
+		case 'E':
+		case '2':
+			comp = 2;
+			break;
+		default:
+			continue;
+		}
+
+		string key = rec->networkCode () + "." + rec->stationCode () + "." +
+		             rec->locationCode () + "." + cha.substr (0, 2);
+		auto res = index.insert (make_pair (key, stations.size ()));
+		if (res.second)
+		{
+			stations.push_back (Station ());
+			stations.back ().network = rec->networkCode ();
+			stations.back ().station = rec->stationCode ();
+			stations.back ().location = rec->locationCode ();
+		}
+
+		Station &station = stations[res.first->second];
+		station.channels[comp] = cha;
+		station.records.push_back (rec);
+	}
+
+	// Only complete three component sets can be processed
+	stations.erase (
+		remove_if (stations.begin (), stations.end (),
+		           [] (const Station &s) {
+			           return s.channels[0].empty () || s.channels[1].empty () ||
+			                  s.channels[2].empty ();
+		           }),
+		stations.end ());
+
+	for (Station &station : stations)
+	{
+		stable_sort (station.records.begin (), station.records.end (),
+		             [] (const RecordPtr &a, const RecordPtr &b) {
+			             return a->startTime () < b->startTime ();
+		             });
+	}
+
+	return !stations.empty ();
+}
+
+// Noise and an S wave train starting at arrival, split into records
+void
+synthesize (
+	const Station &station, const Options &opts, const Core::TimeWindow &tw,
+	const Core::Time &arrival, mt19937 &rng, vector<RecordPtr> &records)
+{
+	normal_distribution<double> noise (0, 1E-8);
+	size_t samplesPerRecord = max<size_t> (1, lround (opts.recordLength * opts.samplingFrequency));
+	size_t samples = lround (tw.length () * opts.samplingFrequency);
+
+	records.clear ();
+	for (size_t offset = 0; offset < samples; offset += samplesPerRecord)
+	{
+		size_t n = min (samplesPerRecord, samples - offset);
+		Core::Time start = tw.startTime () + Core::TimeSpan (offset / opts.samplingFrequency);
+		for (int comp = 0; comp < 3; ++comp)
+		{
+			DoubleArray *data = new DoubleArray (static_cast<int> (n));
+			for (size_t i = 0; i < n; ++i)
+			{
+				double t = (double)(start - arrival) + i / opts.samplingFrequency;
+				double v = noise (rng);
+				if (t >= 0)
+				{
+					v += 1E-6 * (comp == 0 ? 0.5 : 1.0) * exp (-t / 5) * sin (2 * M_PI * 4 * t);
+				}
+				(*data)[i] = v;
+			}
+
+			GenericRecord *rec = new GenericRecord (
+				station.network, station.station, station.location,
+				station.channels[comp], start, opts.samplingFrequency);
+			rec->setData (data);
+			records.push_back (rec);
+		}
+	}
+}
+
+// Creates the processor of a station and configures its streams like scamp
+Processing::AmplitudeProcessorPtr
+createProcessor (const Station &station, const Options &opts)
+{
+	Processing::AmplitudeProcessorPtr proc =
+		Processing::AmplitudeProcessorFactory::Create ("K_Class");
+	if (!proc)
+	{
+		return proc;
+	}
+
+	Processing::WaveformProcessor::Component components[3] = {
+		Processing::WaveformProcessor::VerticalComponent,
+		Processing::WaveformProcessor::FirstHorizontalComponent,
+		Processing::WaveformProcessor::SecondHorizontalComponent};
+	for (int comp = 0; comp < 3; ++comp)
+	{
+		Processing::Stream &stream = proc->streamConfig (components[comp]);
+		stream.setCode (station.channels[comp].c_str ());
+		stream.gain = 1.0;
+		stream.gainUnit = "M/S";
+	}
+
+	Processing::AmplitudeProcessor::Config cfg = proc->config ();
+	cfg.ttInterface = opts.ttInterface;
+	cfg.ttModel = opts.ttModel;
+	proc->setConfig (cfg);
+	return proc;
+}
+
+void
+configure (Config::Config &config, const Options &opts, bool fused)
+{
+	config.setBool ("amplitudes.K_Class.incremental", opts.incremental);
+	config.setBool ("amplitudes.K_Class.parallel", opts.parallel);
+	config.setBool ("amplitudes.K_Class.ttGrid", opts.grid);
+	config.setBool ("amplitudes.K_Class.fusedFilter", fused);
+	config.setString ("amplitudes.K_Class.ttEngine", opts.layered ? "layered" : "table");
+}
+
+// Amplitude published by a new processor of the station for the records,
+// NaN if it publishes none
+double
+replayAmplitude (
+	const Station &station, const Options &opts, const Config::Config &config,
+	const DataModel::Origin *origin, const DataModel::SensorLocation *receiver,
+	const DataModel::Pick *pick, const Core::Time &trigger,
+	const vector<RecordPtr> &records)
+{
+	double amplitude = NAN;
+	Processing::AmplitudeProcessorPtr proc = createProcessor (station, opts);
+	if (!proc)
+	{
+		return amplitude;
+	}
+
+	proc->setPublishFunction (
+		[&amplitude] (const Processing::AmplitudeProcessor *,
+		              const Processing::AmplitudeProcessor::Result &res) {
+			amplitude = res.amplitude.value;
+		});
+	Processing::Settings settings (
+		ModuleName, station.network, station.station, station.location,
+		station.band, &config, nullptr);
+	if (!proc->setup (settings))
+	{
+		return amplitude;
+	}
+
+	proc->setEnvironment (origin, receiver, pick);
+	proc->setTrigger (trigger);
+	for (const RecordPtr &rec : records)
+	{
+		proc->feed (rec.get ());
+	}
+	return amplitude;
+}
+
+// The amplitudes agree within FusedTolerance or are both missing
+bool
+sameAmplitude (double fused, double reference)
+{
+	if (std::isnan (fused) || std::isnan (reference))
+	{
+		return std::isnan (fused) && std::isnan (reference);
+	}
+	return std::fabs (fused - reference) <= FusedTolerance * std::fabs (reference);
+}
+
+void
+report (const char *name, vector<double> &values, uint64_t allocated)
+{
+	if (values.empty ())
+	{
+		return;
+	}
+
+	sort (values.begin (), values.end ());
+	auto percentile = [&values] (double p) {
+		return values[min (values.size () - 1, static_cast<size_t> (p * values.size ()))];
+	};
+
+	printf ("%-16s %10zu %10.1f %10.1f %10.1f %10.1f %10.2f\n", name, values.size (),
+	        percentile (0.5), percentile (0.9), percentile (0.99), values.back (),
+	        double (allocated) / values.size ());
+}
+
+} // namespace
+
+
+int
+main (int argc, char **argv)
+{
+	Options opts;
+	if (!parseOptions (argc, argv, opts))
+	{
+		usage ();
+		return 1;
+	}
+
+	vector<Station> stations;
+	if (!opts.records.empty ())
+	{
+		if (!readStations (opts.records, stations))
+		{
+			cerr << "No three component records found" << endl;
+			return 1;
+		}
+	}
+	else
+	{
+		stations.resize (opts.stations);
+		for (size_t i = 0; i < stations.size (); ++i)
+		{
+			char code[6];
+			snprintf (code, sizeof (code), "S%04zu", i % 10000);
+			stations[i].network = "XX";
+			stations[i].station = code;
+			stations[i].channels[0] = "HHZ";
+			stations[i].channels[1] = "HHN";
+			stations[i].channels[2] = "HHE";
+		}
+	}
+
+	for (Station &station : stations)
+	{
+		station.band = station.channels[0].substr (0, 2);
+	}
+
+	const double lat = 45.0, lon = 10.0;
+	placeStations (stations, lat, lon);
+
+	// File records define the time, synthetic origins start at an arbitrary
+	// epoch
+	Core::Time originTime (1.7E9);
+	if (!stations[0].records.empty ())
+	{
+		originTime = stations[0].records.front ()->startTime () + Core::TimeSpan (60.0);
+	}
+
+	// The reference processors of the fused filter check only differ in
+	// the filter
+	Config::Config config, referenceConfig;
+	configure (config, opts, opts.fused);
+	configure (referenceConfig, opts, false);
+
+	vector<double> latencies[StageCount];
+	uint64_t allocated[StageCount] = {};
+	uint64_t before;
+	size_t fedRecords = 0, amplitudes = 0, failures = 0, fusedChecked = 0;
+	double feedTime = 0;
+	mt19937 rng (12345);
+	vector<RecordPtr> records;
+
+	Clock::time_point total = Clock::now ();
+	for (size_t o = 0; o < opts.origins; ++o)
+	{
+		DataModel::OriginPtr origin = DataModel::Origin::Create ();
+		origin->setLatitude (DataModel::RealQuantity (lat + 0.01 * o));
+		origin->setLongitude (DataModel::RealQuantity (lon));
+		origin->setDepth (DataModel::RealQuantity (5.0 + fmod (o * 7.0, KClass::DepthMax - 10)));
+		origin->setTime (DataModel::TimeQuantity (originTime));
+
+		for (const Station &station : stations)
+		{
+			Processing::AmplitudeProcessorPtr proc = createProcessor (station, opts);
+			if (!proc)
+			{
+				cerr << "K_Class amplitude processor is not available" << endl;
+				return 1;
+			}
+
+			double published = NAN;
+			proc->setPublishFunction (
+				[&amplitudes, &published] (const Processing::AmplitudeProcessor *,
+				                           const Processing::AmplitudeProcessor::Result &res) {
+					++amplitudes;
+					published = res.amplitude.value;
+				});
+
+			Processing::Settings settings (
+				ModuleName, station.network, station.station, station.location,
+				station.band, &config, nullptr);
+
+			Clock::time_point start = Clock::now ();
+			before = allocations.load (memory_order_relaxed);
+			bool ok = proc->setup (settings);
+			allocated[Setup] += allocations.load (memory_order_relaxed) - before;
+			latencies[Setup].push_back (elapsed (start));
+			if (!ok)
+			{
+				cerr << "Setup of " << station.network << "." << station.station
+				     << " failed" << endl;
+				return 1;
+			}
+
+			DataModel::SensorLocationPtr receiver = DataModel::SensorLocation::Create ();
+			receiver->setLatitude (station.latitude);
+			receiver->setLongitude (station.longitude);
+			receiver->setElevation (0.0);
+
+			// The trigger is the first P of the fake table
+			TravelTime p = FakeTravelTimeTable ().computeFirst (
+				lat + 0.01 * o, lon, origin->depth ().value (),
+				station.latitude, station.longitude);
+			Core::Time trigger = originTime + Core::TimeSpan (p.time);
+
+			DataModel::PickPtr pick = DataModel::Pick::Create ();
+			pick->setTime (DataModel::TimeQuantity (trigger));
+
+			start = Clock::now ();
+			before = allocations.load (memory_order_relaxed);
+			proc->setEnvironment (origin.get (), receiver.get (), pick.get ());
+			allocated[SetEnvironment] += allocations.load (memory_order_relaxed) - before;
+			latencies[SetEnvironment].push_back (elapsed (start));
+
+			start = Clock::now ();
+			before = allocations.load (memory_order_relaxed);
+			proc->setTrigger (trigger);
+			allocated[SetTrigger] += allocations.load (memory_order_relaxed) - before;
+			latencies[SetTrigger].push_back (elapsed (start));
+
+			if (proc->status () > Processing::WaveformProcessor::Finished)
+			{
+				++failures;
+				continue;
+			}
+
+			// The [P, S] signal window of the vertical component
+			const Processing::AmplitudeProcessor *vertical = proc->componentProcessor (
+				Processing::WaveformProcessor::VerticalComponent);
+			double signalBegin = vertical->config ().signalBegin;
+			double signalEnd = vertical->config ().signalEnd;
+			Core::TimeWindow verticalWindow = vertical->timeWindow ();
+			check (verticalWindow.startTime () == trigger + Core::TimeSpan (signalBegin) &&
+			           verticalWindow.endTime () == trigger + Core::TimeSpan (signalEnd),
+			       "vertical window is not the signal window");
+
+			if (station.records.empty ())
+			{
+				TravelTime s = FakeTravelTimeTable ().compute (
+					"S", lat + 0.01 * o, lon, origin->depth ().value (),
+					station.latitude, station.longitude);
+				synthesize (station, opts, proc->timeWindow (),
+				            originTime + Core::TimeSpan (s.time), rng, records);
+			}
+
+			const vector<RecordPtr> &input = station.records.empty () ? records : station.records;
+
+			for (const RecordPtr &rec : input)
+			{
+				start = Clock::now ();
+				before = allocations.load (memory_order_relaxed);
+				proc->feed (rec.get ());
+				uint64_t count = allocations.load (memory_order_relaxed) - before;
+				allocated[Feed] += count;
+				double t = elapsed (start);
+				latencies[Feed].push_back (t);
+				feedTime += t;
+				++fedRecords;
+			}
+
+			// The fused filter must give the amplitudes of the per-component
+			// filters
+			if (opts.fused && o == 0 && fusedChecked < FusedChecks)
+			{
+				double reference = replayAmplitude (
+					station, opts, referenceConfig, origin.get (), receiver.get (),
+					pick.get (), trigger, input);
+				if (!sameAmplitude (published, reference))
+				{
+					printf ("%s.%s: fused amplitude %g, per-component %g\n",
+					        station.network.c_str (), station.station.c_str (),
+					        published, reference);
+				}
+				check (sameAmplitude (published, reference),
+				       "fused amplitude differs from the per-component filters");
+				++fusedChecked;
+			}
+
+			// An origin update triggers a reprocess of the buffered data
+			start = Clock::now ();
+			before = allocations.load (memory_order_relaxed);
+			proc->reprocess ();
+			allocated[Reprocess] += allocations.load (memory_order_relaxed) - before;
+			latencies[Reprocess].push_back (elapsed (start));
+
+			// Reprocessing must search Z in the same window again, not in
+			// the horizontal one
+			check (vertical->config ().signalBegin == signalBegin &&
+			           vertical->config ().signalEnd == signalEnd &&
+			           vertical->timeWindow ().startTime () == verticalWindow.startTime () &&
+			           vertical->timeWindow ().endTime () == verticalWindow.endTime (),
+			       "vertical window changed by reprocess");
+		}
+	}
+	double totalTime = elapsed (total);
+
+	struct rusage usage;
+	getrusage (RUSAGE_SELF, &usage);
+
+	printf ("%zu stations, %zu origins, %zu records, %zu amplitudes, %zu rejected\n",
+	        stations.size (), opts.origins, fedRecords, amplitudes, failures);
+	printf ("feed throughput  %.0f records/s (%.0f records/s overall)\n",
+	        feedTime > 0 ? fedRecords / (feedTime * 1E-6) : 0.0,
+	        totalTime > 0 ? fedRecords / (totalTime * 1E-6) : 0.0);
+	printf ("peak RSS         %ld kB\n\n", usage.ru_maxrss);
+	printf ("%-16s %10s %10s %10s %10s %10s %10s\n", "stage [us]", "count", "p50", "p90", "p99",
+	        "max", "allocs");
+	for (int stage = 0; stage < StageCount; ++stage)
+	{
+		report (StageNames[stage], latencies[stage], allocated[stage]);
+	}
+
+	if (mismatches)
+	{
+		printf ("%d mismatches\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+#include "calibration.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+
+namespace KClass
+{
+
+namespace
+{
+
+bool
+parseDouble (const std::string &text, double &value)
+{
+	const char *begin = text.c_str ();
+	char *end;
+	value = strtod (begin, &end);
+	if (end == begin)
+	{
+		return false;
+	}
+	while (*end == ' ' || *end == '\t')
+	{
+		++end;
+	}
+	return *end == '\0';
+}
+
+std::string
+trim (const std::string &text)
+{
+	size_t begin = text.find_first_not_of (" \t");
+	if (begin == std::string::npos)
+	{
+		return std::string ();
+	}
+	size_t end = text.find_last_not_of (" \t");
+	return text.substr (begin, end - begin + 1);
+}
+
+} // namespace
+
+
+bool
+Calibration::set (double A, const std::vector<Segment> &segments)
+{
+	if (segments.empty ())
+	{
+		return false;
+	}
+
+	for (size_t i = 1; i + 1 < segments.size (); ++i)
+	{
+		if (!(segments[i].upper > segments[i - 1].upper))
+		{
+			return false;
+		}
+	}
+
+	_A = A;
+	_profile = nullptr;
+	_corners.clear ();
+	_slopes.clear ();
+	_intercepts.clear ();
+	for (size_t i = 0; i < segments.size (); ++i)
+	{
+		if (i + 1 < segments.size ())
+		{
+			_corners.push_back (segments[i].upper);
+		}
+		_slopes.push_back (A * segments[i].slope);
+		_intercepts.push_back (A * segments[i].intercept);
+	}
+
+	return true;
+}
+
+
+void
+Calibration::set (const Profile &profile)
+{
+	set (profile.A, std::vector<Segment> (profile.segments,
+	                                      profile.segments + profile.segmentCount));
+	_profile = &profile;
+}
+
+
+bool
+Calibration::ParseSegments (const std::string &text, std::vector<Segment> &segments)
+{
+	std::stringstream ss (text);
+	std::string entry;
+	std::vector<std::string> entries;
+	while (std::getline (ss, entry, ','))
+	{
+		entries.push_back (entry);
+	}
+
+	return ParseSegments (entries, segments);
+}
+
+
+bool
+Calibration::ParseSegments (
+	const std::vector<std::string> &list, std::vector<Segment> &segments)
+{
+	segments.clear ();
+
+	std::vector<std::string> entries;
+	for (const std::string &entry : list)
+	{
+		std::string trimmed = trim (entry);
+		if (!trimmed.empty ())
+		{
+			entries.push_back (trimmed);
+		}
+	}
+
+	for (size_t i = 0; i < entries.size (); ++i)
+	{
+		std::vector<std::string> fields;
+		std::stringstream es (entries[i]);
+		std::string field;
+		while (std::getline (es, field, ':'))
+		{
+			fields.push_back (trim (field));
+		}
+
+		bool last = i + 1 == entries.size ();
+		Segment seg;
+		if (fields.size () == 3)
+		{
+			if (!parseDouble (fields[0], seg.upper) ||
+			    !parseDouble (fields[1], seg.slope) ||
+			    !parseDouble (fields[2], seg.intercept))
+			{
+				return false;
+			}
+		}
+		else if (fields.size () == 2 && last)
+		{
+			seg.upper = INFINITY;
+			if (!parseDouble (fields[0], seg.slope) ||
+			    !parseDouble (fields[1], seg.intercept))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+
+		segments.push_back (seg);
+	}
+
+	return !segments.empty ();
+}
+
+
+
+void
+Calibration::magnitudes (
+	size_t n, const double *amplitude, const double *epiKm,
+	const double *depth, double *mag) const
+{
+	if (_profile)
+	{
+		_profile->magnitudes (n, amplitude, epiKm, depth, mag);
+		return;
+	}
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		double R = std::sqrt (epiKm[i] * epiKm[i] + depth[i] * depth[i]);
+		mag[i] = _A * std::log10 (amplitude[i]) + distanceTerm (R);
+	}
+}
+
+} // namespace KClass
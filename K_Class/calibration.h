@@ -0,0 +1,129 @@
+// K_Class distance calibration B(R)
+
+#ifndef __K_Class_CALIBRATION_H__
+#define __K_Class_CALIBRATION_H__
+
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+
+namespace KClass
+{
+
+struct Profile;
+
+// Piecewise linear calibration in log10(R)
+//
+//   K = A * (log10(Amp) + a_i * log10(R) + b_i),  l_(i-1) < R <= l_i
+//
+// with N segments separated by N-1 increasing corner distances l_i
+// (hypocentral, km). The last segment is unbounded. The products A * a_i and
+// A * b_i are precomputed and all arithmetic is double precision. A
+// calibration set from a built-in profile (profiles.h) is evaluated by the
+// kernels of the profile, with identical results.
+class Calibration
+{
+  public:
+	struct Segment
+	{
+		double upper;      // corner distance closing the segment (km)
+		double slope;      // a_i
+		double intercept;  // b_i
+	};
+
+	Calibration () = default;
+
+	// The upper bound of the last segment is ignored. Returns false if
+	// there are no segments or the corners are not strictly increasing.
+	bool set (double A, const std::vector<Segment> &segments);
+
+	// Uses a built-in profile
+	void set (const Profile &profile);
+
+	// The built-in profile in use, null for custom coefficients
+	const Profile *profile () const { return _profile; }
+
+	// Parses a list of "upper:slope:intercept" entries. The last entry
+	// may omit the upper bound ("slope:intercept").
+	static bool
+	ParseSegments (const std::string &text, std::vector<Segment> &segments);
+
+	// Same for the entries of a list parameter, one entry per element
+	static bool
+	ParseSegments (const std::vector<std::string> &entries, std::vector<Segment> &segments);
+
+	size_t segmentCount () const { return _slopes.size (); }
+	double mainSlope () const { return _A; }
+
+	// Index of the segment R falls into
+	size_t
+	segment (double R) const
+	{
+		// Branch-free lower bound over the corners: the number of
+		// corners < R
+		const double *base = _corners.data ();
+		size_t n = _corners.size ();
+		while (n > 1)
+		{
+			size_t half = n / 2;
+			base = base[half - 1] < R ? base + half : base;
+			n -= half;
+		}
+		return (base - _corners.data ()) + (n == 1 && *base < R);
+	}
+
+	// B(R) scaled by A
+	double
+	distanceTerm (double R) const
+	{
+		size_t i = segment (R);
+		return _slopes[i] * std::log10 (R) + _intercepts[i];
+	}
+
+	double magnitude (double amplitude, double R) const;
+
+	// Batch version of magnitude for epicentral distances epiKm and depths
+	// (km) in structure-of-arrays layout, bit-identical to magnitude ().
+	// Amplitudes must be positive.
+	void
+	magnitudes (
+		size_t n, const double *amplitude, const double *epiKm,
+		const double *depth, double *mag) const;
+
+  private:
+	double _A{1.0};
+	std::vector<double> _corners;     // l_1 .. l_(N-1)
+	std::vector<double> _slopes;      // A * a_i
+	std::vector<double> _intercepts;  // A * b_i
+	const Profile *_profile{nullptr};
+};
+
+// Built-in calibration with kernels specialized on its coefficients
+struct Profile
+{
+	const char *name;
+	double A;
+	const Calibration::Segment *segments;
+	size_t segmentCount;
+
+	double (*magnitude) (double amplitude, double R);
+	void (*magnitudes) (
+		size_t n, const double *amplitude, const double *epiKm,
+		const double *depth, double *mag);
+};
+
+inline double
+Calibration::magnitude (double amplitude, double R) const
+{
+	if (_profile)
+	{
+		return _profile->magnitude (amplitude, R);
+	}
+	return _A * std::log10 (amplitude) + distanceTerm (R);
+}
+
+} // namespace KClass
+
+#endif
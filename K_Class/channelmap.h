@@ -0,0 +1,93 @@
+// Channel code to component lookup
+
+#ifndef __K_Class_CHANNELMAP_H__
+#define __K_Class_CHANNELMAP_H__
+
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+
+namespace KClass
+{
+
+// Maps the channel codes of the three components to their index. Codes of
+// up to 7 characters (all SEED codes) are packed into integers so that a
+// lookup is a few integer compares without touching the strings.
+class ChannelMap
+{
+  public:
+	static constexpr int Size = 3;
+
+	void
+	clear ()
+	{
+		for (int i = 0; i < Size; ++i)
+		{
+			_codes[i].clear ();
+			_keys[i] = 0;
+		}
+		_packed = true;
+	}
+
+	void
+	set (int index, const std::string &code)
+	{
+		_codes[index] = code;
+		_keys[index] = code.size () <= MaxPacked ? Pack (code) : 0;
+		_packed = true;
+		for (int i = 0; i < Size; ++i)
+		{
+			_packed = _packed && _codes[i].size () <= MaxPacked;
+		}
+	}
+
+	// Index of the component with this code, -1 if none
+	int
+	find (const std::string &code) const
+	{
+		if (_packed && code.size () <= MaxPacked)
+		{
+			uint64_t key = Pack (code);
+			for (int i = 0; i < Size; ++i)
+			{
+				if (_keys[i] == key && !_codes[i].empty ())
+				{
+					return i;
+				}
+			}
+			return -1;
+		}
+
+		for (int i = 0; i < Size; ++i)
+		{
+			if (!_codes[i].empty () && _codes[i] == code)
+			{
+				return i;
+			}
+		}
+		return -1;
+	}
+
+  private:
+	static constexpr size_t MaxPacked = 7;
+
+	// Characters in the low bytes and the size in the highest byte, so
+	// that codes of different length never share a key
+	static uint64_t
+	Pack (const std::string &code)
+	{
+		uint64_t key = 0;
+		memcpy (&key, code.data (), code.size ());
+		return key | (uint64_t (code.size ()) << 56);
+	}
+
+	std::string _codes[Size];
+	uint64_t _keys[Size] = {0, 0, 0};
+	bool _packed{true};
+};
+
+} // namespace KClass
+
+#endif
@@ -0,0 +1,261 @@
+// Micro benchmark of the core kernels
+//
+// Times the peak searches, the magnitude kernels, the fused filter and the
+// layered travel times of the core library against their plain references.
+// The correctness checks of the same kernels are in coretest.cpp. Needs no
+// SeisComP installation.
+
+#include "absmax.h"
+#include "calibration.h"
+#include "magnitude.h"
+#include "profiles.h"
+#include "ttlayered.h"
+#include "wafilter.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+
+namespace
+{
+
+typedef chrono::steady_clock Clock;
+
+// Runs func repeatedly for at least 0.2 s and returns ns per item
+template <typename Func>
+double
+measure (size_t items, Func func)
+{
+	size_t rounds = 0;
+	Clock::time_point start = Clock::now ();
+	double elapsed;
+	do
+	{
+		func ();
+		++rounds;
+		elapsed = chrono::duration<double, nano> (Clock::now () - start).count ();
+	} while (elapsed < 2E8);
+
+	return elapsed / (rounds * items);
+}
+
+// Plain scalar search with the semantics of Seiscomp's find_absmax
+int
+referenceAbsMax (int n, const double *f, int i1, int i2, double offset)
+{
+	i2 = min (i2, n);
+	int index = i1;
+	double peak = -1;
+	for (int i = i1; i < i2; ++i)
+	{
+		double value = fabs (f[i] - offset);
+		if (value > peak)
+		{
+			peak = value;
+			index = i;
+		}
+	}
+	return index;
+}
+
+void
+benchPeaks (mt19937 &rng)
+{
+	const int n = 1 << 20;
+	normal_distribution<double> dist (0, 1);
+	vector<double> data (n);
+	for (double &v : data)
+	{
+		v = dist (rng);
+	}
+	const double offset = 0.01;
+
+	volatile int sink = 0;
+	double reference = measure (n, [&] { sink = referenceAbsMax (n, data.data (), 0, n, offset); });
+	double dispatch = measure (n, [&] { sink = KClass::find_absmax (n, data.data (), 0, n, offset); });
+	(void)sink;
+	printf ("%-28s %8.3f ns/sample (reference %.3f, %s)\n", "find_absmax", dispatch,
+	        reference, KClass::find_absmax_implementation ());
+
+	// Growing buffer as while records arrive, 1 s of 100 Hz per update
+	const int step = 100;
+	KClass::PeakTracker tracker;
+	double tracked = measure (n, [&] {
+		tracker.reset ();
+		for (int end = step; end <= n; end += step)
+		{
+			sink = tracker.update (end, data.data (), 0, end, offset);
+		}
+	});
+	printf ("%-28s %8.3f ns/sample\n", "PeakTracker (growing)", tracked);
+
+	// Random windows of one buffer as during reprocessing
+	const int queries = 1000;
+	uniform_int_distribution<int> pos (0, n);
+	vector<pair<int, int>> windows (queries);
+	for (auto &w : windows)
+	{
+		w.first = pos (rng);
+		w.second = pos (rng);
+		if (w.first > w.second)
+		{
+			swap (w.first, w.second);
+		}
+		++w.second;
+	}
+
+	KClass::RangeAbsMax range;
+	range.build (n, data.data (), offset);
+	double indexed = measure (queries, [&] {
+		for (auto &w : windows)
+		{
+			sink = range.query (data.data (), w.first, w.second);
+		}
+	});
+	double scanned = measure (queries, [&] {
+		for (auto &w : windows)
+		{
+			sink = KClass::find_absmax (n, data.data (), w.first, w.second, offset);
+		}
+	});
+	printf ("%-28s %8.1f ns/query (scan %.1f)\n", "RangeAbsMax", indexed, scanned);
+}
+
+void
+benchMagnitudes (mt19937 &rng)
+{
+	KClass::Calibration calibration;
+	calibration.set (1.84, {{75, 2.11, 1.32}, {264, 1.1, 3.21}, {800, 2.98, -1.34},
+	                        {INFINITY, 0, 8}});
+
+	const size_t n = 1 << 16;
+	uniform_real_distribution<double> amp (1E-3, 1E3), delta (0, 11), depth (0, 90);
+	vector<double> amplitude (n), deltas (n), depths (n), epiKm (n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		amplitude[i] = amp (rng);
+		deltas[i] = delta (rng);
+		depths[i] = depth (rng);
+		epiKm[i] = deltas[i] * KClass::KmPerDegree;
+	}
+
+	vector<double> scalar (n), batch (n);
+	vector<KClass::Status> status (n);
+
+	double tScalar = measure (n, [&] {
+		for (size_t i = 0; i < n; ++i)
+		{
+			double r = sqrt (epiKm[i] * epiKm[i] + depths[i] * depths[i]);
+			scalar[i] = calibration.magnitude (amplitude[i], r);
+		}
+	});
+	double tBatch = measure (n, [&] {
+		calibration.magnitudes (n, amplitude.data (), epiKm.data (), depths.data (), batch.data ());
+	});
+	printf ("%-28s %8.3f ns/value (scalar %.3f)\n", "Calibration::magnitudes", tBatch, tScalar);
+
+	// The built-in profile of the same coefficients through its folded
+	// kernels
+	if (const KClass::Profile *wsg = KClass::findProfile ("WSG2020"))
+	{
+		KClass::Calibration profile;
+		profile.set (*wsg);
+		double tProfile = measure (n, [&] {
+			for (size_t i = 0; i < n; ++i)
+			{
+				double r = sqrt (epiKm[i] * epiKm[i] + depths[i] * depths[i]);
+				batch[i] = profile.magnitude (amplitude[i], r);
+			}
+		});
+		printf ("%-28s %8.3f ns/value\n", "Profile WSG2020", tProfile);
+	}
+
+	double tStation = measure (n, [&] {
+		KClass::computeMagnitudes (calibration, n, amplitude.data (), deltas.data (),
+		                           depths.data (), batch.data (), status.data ());
+	});
+	printf ("%-28s %8.3f ns/value\n", "computeMagnitudes", tStation);
+}
+
+void
+benchFilter (mt19937 &rng)
+{
+	const size_t n = 1 << 16;
+	normal_distribution<double> noise;
+	vector<double> input[3];
+	for (vector<double> &samples : input)
+	{
+		samples.resize (n);
+		for (double &v : samples)
+		{
+			v = noise (rng);
+		}
+	}
+
+	KClass::WoodAndersonResponse response;
+	KClass::WoodAndersonFilter fused, single;
+	for (int lane = 0; lane < 3; ++lane)
+	{
+		fused.setLane (lane, 100, response);
+		single.setLane (lane, 100, response);
+	}
+
+	vector<double> a[3], b[3];
+	double tFused = measure (3 * n, [&] {
+		for (int lane = 0; lane < 3; ++lane)
+		{
+			a[lane] = input[lane];
+		}
+		fused.apply (n, a[0].data (), a[1].data (), a[2].data ());
+	});
+	double tSingle = measure (3 * n, [&] {
+		for (int lane = 0; lane < 3; ++lane)
+		{
+			b[lane] = input[lane];
+			single.apply (lane, n, b[lane].data ());
+		}
+	});
+	printf ("%-28s %8.3f ns/sample (per lane %.3f)\n", "WoodAndersonFilter", tFused, tSingle);
+}
+
+void
+benchTravelTimes ()
+{
+	vector<KClass::LayeredModel::Layer> layers;
+	KClass::LayeredModel model;
+	KClass::LayeredModel::Parse (KClass::LayeredModel::DefaultModel, layers);
+	model.set (layers);
+
+	const size_t n = 1000;
+	vector<double> distance (n), elevation (n, 0.2), p (n), s (n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		distance[i] = i * 1000.0 / n;
+	}
+	double t = measure (n, [&] {
+		model.firstArrivals (n, distance.data (), elevation.data (), 12.0, p.data (), s.data ());
+	});
+	printf ("%-28s %8.3f ns/station\n", "LayeredModel", t);
+}
+
+} // namespace
+
+
+int
+main (int argc, char **argv)
+{
+	mt19937 rng (argc > 1 ? atoi (argv[1]) : 1);
+
+	benchPeaks (rng);
+	benchMagnitudes (rng);
+	benchFilter (rng);
+	benchTravelTimes ();
+
+	return 0;
+}
@@ -0,0 +1,1198 @@
+// Unit tests of the core library
+//
+// Checks every optimized kernel of the core library against its plain
+// reference and the other core modules against known values. Also checks
+// that the kernels of the per-station path do not allocate once warmed up.
+// Needs no SeisComP installation. Exits with 1 if a check fails.
+
+#include "absmax.h"
+#include "amplitude.h"
+#include "calibration.h"
+#include "channelmap.h"
+#include "magnitude.h"
+#include "profiles.h"
+#include "published.h"
+#include "regions.h"
+#include "taskpool.h"
+#include "ttcache.h"
+#include "ttgrid.h"
+#include "ttlayered.h"
+#include "wafilter.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+namespace
+{
+
+// Heap allocations, counted by the replaced operator new
+atomic<uint64_t> allocations{0};
+
+void *
+allocate (size_t size)
+{
+	allocations.fetch_add (1, memory_order_relaxed);
+	if (void *p = malloc (size ? size : 1))
+	{
+		return p;
+	}
+	throw bad_alloc ();
+}
+
+void *
+allocate (size_t size, align_val_t alignment)
+{
+	allocations.fetch_add (1, memory_order_relaxed);
+	size_t align = static_cast<size_t> (alignment);
+	if (void *p = aligned_alloc (align, (size + align - 1) / align * align))
+	{
+		return p;
+	}
+	throw bad_alloc ();
+}
+
+} // namespace
+
+
+// All forms are replaced, so that every delete frees memory of the
+// matching new
+void *operator new (size_t size) { return allocate (size); }
+void *operator new[] (size_t size) { return allocate (size); }
+void *operator new (size_t size, align_val_t align) { return allocate (size, align); }
+void *operator new[] (size_t size, align_val_t align) { return allocate (size, align); }
+void operator delete (void *p) noexcept { free (p); }
+void operator delete[] (void *p) noexcept { free (p); }
+void operator delete (void *p, size_t) noexcept { free (p); }
+void operator delete[] (void *p, size_t) noexcept { free (p); }
+void operator delete (void *p, align_val_t) noexcept { free (p); }
+void operator delete[] (void *p, align_val_t) noexcept { free (p); }
+void operator delete (void *p, size_t, align_val_t) noexcept { free (p); }
+void operator delete[] (void *p, size_t, align_val_t) noexcept { free (p); }
+
+
+namespace
+{
+
+int failures = 0;
+
+void
+check (bool ok, const char *what)
+{
+	if (!ok)
+	{
+		printf ("FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+// Number of heap allocations of func
+template <typename Func>
+uint64_t
+countAllocations (Func func)
+{
+	uint64_t before = allocations.load (memory_order_relaxed);
+	func ();
+	return allocations.load (memory_order_relaxed) - before;
+}
+
+// Plain scalar search with the semantics of Seiscomp's find_absmax
+int
+referenceAbsMax (int n, const double *f, int i1, int i2, double offset)
+{
+	i2 = min (i2, n);
+	int index = i1;
+	double peak = -1;
+	for (int i = i1; i < i2; ++i)
+	{
+		double value = fabs (f[i] - offset);
+		if (value > peak)
+		{
+			peak = value;
+			index = i;
+		}
+	}
+	return index;
+}
+
+void
+testAmplitudes ()
+{
+	KClass::AmplitudeValue v0, v1;
+	v0.value = 2;
+	v0.lower = 3;
+	v1.value = 5;
+	v1.lower = 4;
+	KClass::AmplitudeValue v = KClass::summ (v0, v1);
+	check (v.value == 7 && v.lower == 5 && v.upper == 0, "summ");
+
+	KClass::AmplitudeTime t0, t1;
+	t0.reference = 100;
+	t0.begin = -1;
+	t0.end = 2;
+	t1.reference = 110;
+	KClass::AmplitudeTime t = KClass::average (t0, t1);
+	check (t.reference == 105 && t.begin == -6 && t.end == 5, "average");
+
+	KClass::FirstArrivals arrivals;
+	arrivals.haveP = arrivals.haveS = true;
+	arrivals.p = 10;
+	arrivals.s = 17;
+	KClass::SignalWindow window;
+	check (KClass::verticalWindow (arrivals, 9, window) && window.begin == 1 &&
+	           window.end == 8,
+	       "verticalWindow");
+	arrivals.haveS = false;
+	check (!KClass::verticalWindow (arrivals, 9, window), "verticalWindow");
+
+	double amplitude;
+	check (KClass::peakAmplitude (-2, 1, 1E3, amplitude) == KClass::AmplitudeOK &&
+	           amplitude == 3,
+	       "peakAmplitude");
+	check (KClass::peakAmplitude (1, 1, 1, amplitude) == KClass::NoPeak, "peakAmplitude");
+	check (KClass::peakAmplitude (2, 1, 0, amplitude) == KClass::ZeroGain, "peakAmplitude");
+}
+
+void
+testPeaks (mt19937 &rng)
+{
+	const int n = 1 << 16;
+	normal_distribution<double> dist (0, 1);
+	vector<double> data (n);
+	for (double &v : data)
+	{
+		v = dist (rng);
+	}
+	const double offset = 0.01;
+
+	uniform_int_distribution<int> pos (0, n);
+	for (int i = 0; i < 1000; ++i)
+	{
+		int i1 = pos (rng), i2 = pos (rng);
+		if (i1 > i2)
+		{
+			swap (i1, i2);
+		}
+		check (KClass::find_absmax (n, data.data (), i1, i2 + 1, offset) ==
+		           referenceAbsMax (n, data.data (), i1, i2 + 1, offset),
+		       "find_absmax");
+	}
+
+	// Growing buffer as while records arrive, 1 s of 100 Hz per update
+	const int step = 100;
+	KClass::PeakTracker tracker;
+	for (int end = step; end <= 100 * step; end += step)
+	{
+		check (tracker.update (end, data.data (), 0, end, offset) ==
+		           referenceAbsMax (end, data.data (), 0, end, offset),
+		       "PeakTracker");
+	}
+
+	// Random windows of one buffer as during reprocessing
+	vector<pair<int, int>> windows (1000);
+	for (auto &w : windows)
+	{
+		w.first = pos (rng);
+		w.second = pos (rng);
+		if (w.first > w.second)
+		{
+			swap (w.first, w.second);
+		}
+		++w.second;
+	}
+
+	KClass::RangeAbsMax range;
+	range.build (n, data.data (), offset);
+	for (auto &w : windows)
+	{
+		check (range.query (data.data (), w.first, w.second) ==
+		           referenceAbsMax (n, data.data (), w.first, w.second, offset),
+		       "RangeAbsMax");
+	}
+
+	// Growing buffer followed by reprocessing with different windows
+	KClass::PeakSearch search;
+	for (int end = step; end <= 100 * step; end += step)
+	{
+		check (search.find (end, data.data (), 0, end, offset) ==
+		           referenceAbsMax (end, data.data (), 0, end, offset),
+		       "PeakSearch");
+	}
+	for (auto &w : windows)
+	{
+		int i2 = min (w.second, 100 * step);
+		int i1 = min (w.first, i2);
+		check (search.find (100 * step, data.data (), i1, i2, offset) ==
+		           referenceAbsMax (100 * step, data.data (), i1, i2, offset),
+		       "PeakSearch");
+	}
+	check (search.method () == KClass::PeakSearch::RangeIndex, "PeakSearch method");
+}
+
+void
+testSegments ()
+{
+	vector<KClass::Calibration::Segment> segments;
+	check (KClass::Calibration::ParseSegments (
+	           " 75:2.11:1.32, 264 : 1.1 : 3.21,800:2.98:-1.34, 0:8 ", segments) &&
+	           segments.size () == 4,
+	       "ParseSegments");
+	if (segments.size () == 4)
+	{
+		check (segments[0].upper == 75 && segments[0].slope == 2.11 &&
+		           segments[0].intercept == 1.32 && segments[1].upper == 264 &&
+		           segments[1].slope == 1.1 && segments[2].intercept == -1.34 &&
+		           std::isinf (segments[3].upper) && segments[3].slope == 0 &&
+		           segments[3].intercept == 8,
+		       "ParseSegments values");
+	}
+
+	// A single unbounded segment, the last one may keep its upper bound
+	check (KClass::Calibration::ParseSegments ("1.5:2", segments) && segments.size () == 1 &&
+	           std::isinf (segments[0].upper),
+	       "ParseSegments single");
+	check (KClass::Calibration::ParseSegments ("75:2.11:1.32, 900:0:8", segments) &&
+	           segments.size () == 2 && segments[1].upper == 900,
+	       "ParseSegments bounded last");
+
+	const char *invalid[] = {
+		"", " , ", "75:2.11:1.32:4", "x:2.11:1.32", "75:2.11:1.32 km",
+		"2.11:1.32, 264:1.1:3.21"};
+	for (const char *text : invalid)
+	{
+		check (!KClass::Calibration::ParseSegments (text, segments), "ParseSegments invalid");
+	}
+
+	// Elements of a list parameter, as SeisComP splits the configured value
+	check (KClass::Calibration::ParseSegments (
+	           vector<string>{"75:2.11:1.32", " 264:1.1:3.21", "800:2.98:-1.34 ", "0:8"},
+	           segments) &&
+	           segments.size () == 4 && segments[1].upper == 264 && segments[3].intercept == 8,
+	       "ParseSegments list");
+	check (!KClass::Calibration::ParseSegments (vector<string>{"75:2.11:1.32, 0:8"}, segments),
+	       "ParseSegments list element with comma");
+	check (!KClass::Calibration::ParseSegments (vector<string>{"0:8", "75:2.11:1.32"}, segments),
+	       "ParseSegments list open segment first");
+	check (!KClass::Calibration::ParseSegments (vector<string>{}, segments),
+	       "ParseSegments empty list");
+
+	// The corners have to increase, the last upper bound is ignored
+	KClass::Calibration calibration;
+	KClass::Calibration::ParseSegments ("264:1.1:3.21, 75:2.11:1.32, 0:8", segments);
+	check (!calibration.set (1.84, segments), "Calibration::set decreasing corners");
+	KClass::Calibration::ParseSegments ("75:2.11:1.32, 264:1.1:3.21, 10:0:8", segments);
+	check (calibration.set (1.84, segments) && calibration.segmentCount () == 3,
+	       "Calibration::set");
+	check (calibration.segment (75) == 0 && calibration.segment (75.001) == 1 &&
+	           calibration.segment (1E6) == 2,
+	       "Calibration::segment");
+}
+
+// compute_K_Class of the original plugin with its four default segments,
+// including its float intermediates
+double
+baselineMagnitude (double amplitude, double delta, double depth)
+{
+	const double A = 1.84;
+	const double l1 = 75.0, l2 = 264.0, l3 = 800.0;
+	const double a1 = 2.11, a2 = 1.1, a3 = 2.98, a4 = 0.0;
+	const double b1 = 1.32, b2 = 3.21, b3 = -1.34, b4 = 8.0;
+
+	float epDistKm = delta * KClass::KmPerDegree;
+	float hypDistKm = sqrt (epDistKm * epDistKm + depth * depth);
+	float magCalc;
+	if (hypDistKm <= l1)
+	{
+		magCalc = A * (log10 (amplitude) + a1 * log10 (hypDistKm) + b1);
+	}
+	else if (hypDistKm <= l2)
+	{
+		magCalc = A * (log10 (amplitude) + a2 * log10 (hypDistKm) + b2);
+	}
+	else if (hypDistKm <= l3)
+	{
+		magCalc = A * (log10 (amplitude) + a3 * log10 (hypDistKm) + b3);
+	}
+	else
+	{
+		magCalc = A * (log10 (amplitude) + a4 * log10 (hypDistKm) + b4);
+	}
+	return magCalc;
+}
+
+// The documented default table and the built-in default profile reproduce
+// the original magnitudes up to its float precision
+void
+testBaseline (mt19937 &rng)
+{
+	vector<KClass::Calibration::Segment> segments;
+	KClass::Calibration table;
+	check (KClass::Calibration::ParseSegments (
+	           vector<string>{"75:2.11:1.32", "264:1.1:3.21", "800:2.98:-1.34", "0:8"},
+	           segments) &&
+	           table.set (1.84, segments),
+	       "default segments");
+
+	KClass::Calibration profile;
+	const KClass::Profile *wsg = KClass::findProfile ("WSG2020");
+	check (wsg != nullptr, "findProfile");
+	if (wsg)
+	{
+		profile.set (*wsg);
+	}
+
+	uniform_real_distribution<double> amp (-3, 3), delta (0, KClass::DeltaMax),
+		depth (0, KClass::DepthMax);
+	double maxError = 0;
+	for (int i = 0; i < 100000; ++i)
+	{
+		double a = pow (10, amp (rng)), d = delta (rng), z = depth (rng);
+		double expected = baselineMagnitude (a, d, z);
+		double mag;
+		for (const KClass::Calibration *calibration : {&table, &profile})
+		{
+			if (KClass::computeMagnitude (*calibration, a, d, z, mag) != KClass::OK)
+			{
+				maxError = INFINITY;
+			}
+			maxError = max (maxError, fabs (mag - expected));
+		}
+	}
+	check (maxError < 1E-5, "baseline magnitudes");
+}
+
+void
+testMagnitudes (mt19937 &rng)
+{
+	KClass::Calibration calibration;
+	calibration.set (1.84, {{75, 2.11, 1.32}, {264, 1.1, 3.21}, {800, 2.98, -1.34},
+	                        {INFINITY, 0, 8}});
+
+	const size_t n = 1 << 14;
+	uniform_real_distribution<double> amp (1E-3, 1E3), delta (0, 11), depth (0, 90);
+	vector<double> amplitude (n), deltas (n), depths (n), epiKm (n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		amplitude[i] = amp (rng);
+		deltas[i] = delta (rng);
+		depths[i] = depth (rng);
+		epiKm[i] = deltas[i] * KClass::KmPerDegree;
+	}
+
+	vector<double> scalar (n), batch (n);
+	vector<KClass::Status> status (n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		double r = sqrt (epiKm[i] * epiKm[i] + depths[i] * depths[i]);
+		scalar[i] = calibration.magnitude (amplitude[i], r);
+	}
+	calibration.magnitudes (n, amplitude.data (), epiKm.data (), depths.data (), batch.data ());
+	check (memcmp (scalar.data (), batch.data (), n * sizeof (double)) == 0,
+	       "Calibration::magnitudes");
+
+	// The built-in profile of the same coefficients through its folded
+	// kernels
+	const KClass::Profile *wsg = KClass::findProfile ("WSG2020");
+	check (wsg != nullptr, "findProfile");
+	if (wsg)
+	{
+		KClass::Calibration profile;
+		profile.set (*wsg);
+		vector<double> folded (n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			double r = sqrt (epiKm[i] * epiKm[i] + depths[i] * depths[i]);
+			folded[i] = profile.magnitude (amplitude[i], r);
+		}
+		check (memcmp (scalar.data (), folded.data (), n * sizeof (double)) == 0,
+		       "Profile WSG2020");
+		profile.magnitudes (n, amplitude.data (), epiKm.data (), depths.data (), folded.data ());
+		check (memcmp (scalar.data (), folded.data (), n * sizeof (double)) == 0,
+		       "Profile WSG2020 batch");
+	}
+
+	KClass::computeMagnitudes (calibration, n, amplitude.data (), deltas.data (),
+	                           depths.data (), batch.data (), status.data ());
+	for (size_t i = 0; i < n; ++i)
+	{
+		double mag = 0;
+		KClass::Status s = KClass::computeMagnitude (
+			calibration, amplitude[i], deltas[i], depths[i], mag);
+		if (!(s == status[i] && (s != KClass::OK || mag == batch[i])))
+		{
+			check (false, "computeMagnitudes");
+			break;
+		}
+	}
+}
+
+void
+testFilter (mt19937 &rng)
+{
+	const size_t n = 1 << 14;
+	normal_distribution<double> noise;
+	vector<double> input[3];
+	for (vector<double> &samples : input)
+	{
+		samples.resize (n);
+		for (double &v : samples)
+		{
+			v = noise (rng);
+		}
+	}
+
+	// One lane at another sampling frequency, the lanes are independent
+	KClass::WoodAndersonResponse response;
+	KClass::WoodAndersonFilter fused, single;
+	for (int lane = 0; lane < 3; ++lane)
+	{
+		double fsamp = lane == 2 ? 40 : 100;
+		fused.setLane (lane, fsamp, response);
+		single.setLane (lane, fsamp, response);
+	}
+
+	vector<double> a[3], b[3];
+	for (int lane = 0; lane < 3; ++lane)
+	{
+		a[lane] = b[lane] = input[lane];
+		single.apply (lane, n, b[lane].data ());
+	}
+	fused.apply (n, a[0].data (), a[1].data (), a[2].data ());
+	for (int lane = 0; lane < 3; ++lane)
+	{
+		check (memcmp (a[lane].data (), b[lane].data (), n * sizeof (double)) == 0,
+		       "WoodAndersonFilter");
+	}
+
+	// Steady-state amplitude of a 1 Hz sine of 1 m/s at 100 Hz. The bilinear
+	// transform maps it exactly onto the analog response at the prewarped
+	// frequency, which is within 0.1 % of the response at 1 Hz.
+	const double fsamp = 100, f = 1;
+	vector<double> sine (20 * fsamp);
+	for (size_t i = 0; i < sine.size (); ++i)
+	{
+		sine[i] = sin (2 * M_PI * f * i / fsamp);
+	}
+	single.setLane (0, fsamp, response);
+	single.apply (0, sine.size (), sine.data ());
+
+	// RMS over the last 5 periods, the transient has decayed by then
+	double power = 0;
+	size_t tail = 5 * fsamp;
+	for (size_t i = sine.size () - tail; i < sine.size (); ++i)
+	{
+		power += sine[i] * sine[i];
+	}
+	double measured = sqrt (2 * power / tail);
+
+	auto analog = [&response] (double w) {
+		double w0 = 2 * M_PI / response.period;
+		return response.gain * w /
+		       sqrt ((w0 * w0 - w * w) * (w0 * w0 - w * w) +
+		             4 * response.damping * response.damping * w0 * w0 * w * w);
+	};
+	double prewarped = 2 * fsamp * tan (M_PI * f / fsamp);
+	check (fabs (measured / analog (prewarped) - 1) < 1E-6, "WoodAndersonFilter response");
+	check (fabs (measured / analog (2 * M_PI * f) - 1) < 1E-3, "WoodAndersonFilter scale");
+}
+
+void
+testTravelTimes ()
+{
+	// A single layer has straight rays
+	vector<KClass::LayeredModel::Layer> layers;
+	KClass::LayeredModel model;
+	check (KClass::LayeredModel::Parse ("0:6:3.5", layers) && model.set (layers),
+	       "LayeredModel::Parse");
+	bool straight = true;
+	for (double distance = 0; distance < 1000; distance += 7.3)
+	{
+		for (double depth = 0; depth < 80; depth += 3.1)
+		{
+			KClass::FirstArrivals arrivals;
+			double r = sqrt (distance * distance + (depth + 0.5) * (depth + 0.5));
+			straight = straight && model.firstArrivals (distance, depth, 0.5, arrivals) &&
+			           fabs (arrivals.p - r / 6) < 1E-9 && fabs (arrivals.s - r / 3.5) < 1E-9;
+		}
+	}
+	check (straight, "LayeredModel direct wave");
+
+	// Surface source over a half-space: the head wave overtakes the direct
+	// wave beyond the crossover distance
+	check (KClass::LayeredModel::Parse ("0:6:3.5, 30:8:4.5", layers) && model.set (layers),
+	       "LayeredModel::Parse");
+	double delay = 60 * sqrt (1 / 36.0 - 1 / 64.0);
+	double crossover = delay / (1 / 6.0 - 1 / 8.0);
+	KClass::FirstArrivals before, after;
+	model.firstArrivals (crossover - 1, 0, 0, before);
+	model.firstArrivals (crossover + 1, 0, 0, after);
+	check (fabs (before.p - (crossover - 1) / 6) < 1E-9 &&
+	           fabs (after.p - ((crossover + 1) / 8 + delay)) < 1E-9,
+	       "LayeredModel head wave");
+
+	check (KClass::LayeredModel::Parse (KClass::LayeredModel::DefaultModel, layers) &&
+	           model.set (layers),
+	       "LayeredModel::DefaultModel");
+}
+
+void
+testTravelTimeCache ()
+{
+	KClass::TravelTimeCache &cache = KClass::TravelTimeCache::Instance ();
+	size_t capacity = cache.capacity ();
+	cache.clear ();
+	cache.setCapacity (3);
+
+	uint32_t table = cache.table ("coretest", "lru");
+	check (cache.table ("coretest", "lru") == table && cache.table ("coretest", "other") != table,
+	       "TravelTimeCache::table");
+
+	// Keys within half a quantization step share an entry
+	check (KClass::TravelTimeCache::makeKey (table, 10, 1.0, 0) ==
+	           KClass::TravelTimeCache::makeKey (
+		           table, 10 + 0.4 * KClass::TravelTimeCache::DepthStep,
+		           1.0 + 0.4 * KClass::TravelTimeCache::DistanceStep, 4),
+	       "TravelTimeCache::makeKey");
+
+	KClass::TravelTimeCache::Key keys[4];
+	KClass::FirstArrivals arrivals[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		keys[i] = KClass::TravelTimeCache::makeKey (table, 10, i, 0);
+		arrivals[i].haveP = arrivals[i].haveS = true;
+		arrivals[i].p = i;
+		arrivals[i].s = 2 * i;
+	}
+
+	// Looking up 0 makes 1 the least recently used entry, which the fourth
+	// insertion evicts
+	KClass::FirstArrivals found;
+	for (int i = 0; i < 3; ++i)
+	{
+		cache.insert (keys[i], arrivals[i]);
+	}
+	check (cache.lookup (keys[0], found) && found.p == 0 && found.s == 0,
+	       "TravelTimeCache lookup");
+	cache.insert (keys[3], arrivals[3]);
+	check (cache.size () == 3, "TravelTimeCache size");
+	check (!cache.lookup (keys[1], found), "TravelTimeCache eviction");
+	check (cache.lookup (keys[2], found) && found.p == 2 && cache.lookup (keys[3], found) &&
+	           found.p == 3 && cache.lookup (keys[0], found) && found.p == 0,
+	       "TravelTimeCache retained");
+
+	// Reinserting a key updates it and makes it the most recent, so
+	// shrinking keeps it
+	arrivals[2].p = 20;
+	cache.insert (keys[2], arrivals[2]);
+	cache.setCapacity (1);
+	check (cache.size () == 1 && cache.lookup (keys[2], found) && found.p == 20,
+	       "TravelTimeCache update");
+	check (cache.hits () == 5 && cache.misses () == 1, "TravelTimeCache statistics");
+
+	// A capacity of 0 disables the cache
+	cache.setCapacity (0);
+	cache.insert (keys[0], arrivals[0]);
+	check (cache.size () == 0 && !cache.lookup (keys[0], found), "TravelTimeCache disabled");
+
+	cache.clear ();
+	cache.setCapacity (capacity);
+}
+
+// Straight rays in a half space with the surface velocities of the grid,
+// S only up to 1.525 degrees
+bool
+halfSpaceArrivals (double distance, double depth, double elevation, KClass::FirstArrivals &arrivals)
+{
+	double x = distance * KClass::KmPerDegree;
+	double z = depth + elevation;
+	double r = sqrt (x * x + z * z);
+	arrivals.haveP = true;
+	arrivals.p = r / KClass::TravelTimeGrid::SurfaceVp;
+	arrivals.haveS = distance <= 1.525;
+	arrivals.s = r / KClass::TravelTimeGrid::SurfaceVs;
+	return true;
+}
+
+bool
+sameArrivals (const KClass::FirstArrivals &a, const KClass::FirstArrivals &b)
+{
+	return a.haveP == b.haveP && a.haveS == b.haveS && (!a.haveP || a.p == b.p) &&
+	       (!a.haveS || a.s == b.s);
+}
+
+void
+testTravelTimeGrid (mt19937 &rng)
+{
+	KClass::TravelTimeGrid::Parameters params;
+	params.table = "test/halfspace";
+	params.maxDistance = 2.0;
+	params.maxDepth = 40.0;
+	params.distanceStep = 0.05;
+	params.depthStep = 2.0;
+
+	size_t evaluations = 0;
+	KClass::TravelTimeGrid::Evaluator eval =
+		[&evaluations] (double distance, double depth, double elevation,
+		                KClass::FirstArrivals &arrivals) {
+			++evaluations;
+			return halfSpaceArrivals (distance, depth, elevation, arrivals);
+		};
+
+	shared_ptr<KClass::TravelTimeGrid> grid = KClass::TravelTimeGrid::Build (params, eval);
+	check (grid && evaluations == KClass::TravelTimeGrid::Evaluations (params),
+	       "TravelTimeGrid::Evaluations");
+	if (!grid)
+	{
+		return;
+	}
+	check (grid->maxErrorP () > 0 && grid->maxErrorS () > 0 && isfinite (grid->maxErrorP ()) &&
+	           isfinite (grid->maxErrorS ()),
+	       "TravelTimeGrid error estimate");
+
+	// The nodes are exact, up to the last cell with S at all nodes
+	bool nodes = true;
+	for (int iz = 0; iz <= 20; ++iz)
+	{
+		for (int ix = 0; ix < 30; ++ix)
+		{
+			KClass::FirstArrivals exact, approx;
+			halfSpaceArrivals (ix * params.distanceStep, iz * params.depthStep, 0.0, exact);
+			nodes = nodes &&
+			        grid->interpolate (ix * params.distanceStep, iz * params.depthStep, 0.0,
+			                           approx) &&
+			        approx.haveP && approx.haveS && fabs (approx.p - exact.p) < 1E-9 &&
+			        fabs (approx.s - exact.s) < 1E-9;
+		}
+	}
+	check (nodes, "TravelTimeGrid nodes");
+
+	// Bilinear interpolation deviates from r/v by at most
+	// (hx^2 + hz^2) / (8 v r) with r the smallest source distance of the
+	// cell, which bounds both second derivatives by 1/(v r). A phase
+	// missing at one node of the cell is not reported.
+	double hx = params.distanceStep * KClass::KmPerDegree;
+	double hz = params.depthStep;
+	double diagonal = sqrt (hx * hx + hz * hz);
+	uniform_real_distribution<double> distances (0, params.maxDistance);
+	uniform_real_distribution<double> depths (0, params.maxDepth);
+	bool bounded = true, missing = true;
+	for (int i = 0; i < 100000; ++i)
+	{
+		double distance = distances (rng);
+		double depth = depths (rng);
+		KClass::FirstArrivals exact, approx;
+		halfSpaceArrivals (distance, depth, 0.0, exact);
+		if (!grid->interpolate (distance, depth, 0.0, approx) || !approx.haveP)
+		{
+			bounded = false;
+			continue;
+		}
+
+		if (distance > 1.5)
+		{
+			missing = missing && !approx.haveS;
+		}
+
+		double x = distance * KClass::KmPerDegree;
+		double r = sqrt (x * x + depth * depth) - diagonal;
+		if (r < 10)
+		{
+			continue;
+		}
+		double bound = (hx * hx + hz * hz) / (8 * r);
+		bounded = bounded && fabs (approx.p - exact.p) <= bound / KClass::TravelTimeGrid::SurfaceVp;
+		if (distance < 1.5)
+		{
+			bounded = bounded && approx.haveS &&
+			          fabs (approx.s - exact.s) <= bound / KClass::TravelTimeGrid::SurfaceVs;
+		}
+	}
+	check (bounded, "TravelTimeGrid interpolation error");
+	check (missing, "TravelTimeGrid missing phase");
+
+	KClass::FirstArrivals outside;
+	check (!grid->interpolate (2.01, 10, 0, outside) && !grid->interpolate (-0.01, 10, 0, outside) &&
+	           !grid->interpolate (1, 40.1, 0, outside) && !grid->interpolate (1, -0.1, 0, outside),
+	       "TravelTimeGrid outside");
+
+	// The elevation correction adds the vertical leg of the ray above sea
+	// level. What remains is the error of the ray parameter taken from the
+	// cell slope and the curvature of the wave front, below a fifth of the
+	// leg and within the error estimate of the grid.
+	bool corrected = true;
+	for (double distance : {0.5, 1.0, 1.45})
+	{
+		for (double depth : {10.0, 20.0, 30.0})
+		{
+			KClass::FirstArrivals sea, elevated, exact;
+			halfSpaceArrivals (distance, depth, 2.0, exact);
+			grid->interpolate (distance, depth, 0.0, sea);
+			grid->interpolate (distance, depth, 2.0, elevated);
+			corrected = corrected &&
+			            fabs (elevated.p - exact.p) < 0.2 * (exact.p - sea.p) &&
+			            fabs (elevated.s - exact.s) < 0.2 * (exact.s - sea.s) &&
+			            fabs (elevated.p - exact.p) <= grid->maxErrorP () &&
+			            fabs (elevated.s - exact.s) <= grid->maxErrorS ();
+		}
+	}
+	check (corrected, "TravelTimeGrid elevation correction");
+
+	// A saved grid maps back with the same times, stale, corrupt and
+	// truncated files are rejected
+	char path[] = "/tmp/kclass-grid-XXXXXX";
+	int fd = mkstemp (path);
+	if (fd < 0)
+	{
+		check (false, "TravelTimeGrid temporary file");
+		return;
+	}
+	close (fd);
+
+	check (grid->save (path), "TravelTimeGrid::save");
+	shared_ptr<KClass::TravelTimeGrid> loaded = KClass::TravelTimeGrid::Load (params, path);
+	bool same = loaded && loaded->maxErrorP () == grid->maxErrorP () &&
+	            loaded->maxErrorS () == grid->maxErrorS ();
+	for (int i = 0; same && i < 10000; ++i)
+	{
+		double distance = distances (rng);
+		double depth = depths (rng);
+		KClass::FirstArrivals a, b;
+		same = grid->interpolate (distance, depth, 1.0, a) &&
+		       loaded->interpolate (distance, depth, 1.0, b) && sameArrivals (a, b);
+	}
+	check (same, "TravelTimeGrid::Load");
+	loaded.reset ();
+
+	KClass::TravelTimeGrid::Parameters other = params;
+	other.depthStep = 1.0;
+	check (!KClass::TravelTimeGrid::Load (other, path), "TravelTimeGrid::Load other parameters");
+
+	FILE *fp = fopen (path, "r+b");
+	bool corrupt = fp && fputc ('X', fp) != EOF;
+	corrupt = fp && fclose (fp) == 0 && corrupt;
+	check (corrupt && !KClass::TravelTimeGrid::Load (params, path), "TravelTimeGrid corrupt file");
+
+	struct stat st;
+	check (grid->save (path) && stat (path, &st) == 0 &&
+	           truncate (path, st.st_size - sizeof (double)) == 0 &&
+	           !KClass::TravelTimeGrid::Load (params, path),
+	       "TravelTimeGrid truncated file");
+	check (grid->save (path) && truncate (path, 16) == 0 &&
+	           !KClass::TravelTimeGrid::Load (params, path),
+	       "TravelTimeGrid truncated header");
+
+	// The shared grid replaces an unusable file, telling how long that takes
+	params.table = "test/shared";
+	size_t notified = 0;
+	double seconds = -1;
+	KClass::TravelTimeGrid::BuildNotifier notify = [&notified, &seconds] (size_t n, double s) {
+		notified = n;
+		seconds = s;
+	};
+	shared_ptr<const KClass::TravelTimeGrid> shared =
+		KClass::TravelTimeGrid::Shared (params, path, eval, notify);
+	check (shared && notified == KClass::TravelTimeGrid::Evaluations (params) && seconds >= 0,
+	       "TravelTimeGrid::Shared build");
+	check (KClass::TravelTimeGrid::Load (params, path) != nullptr, "TravelTimeGrid::Shared save");
+	notified = 0;
+	check (KClass::TravelTimeGrid::Shared (params, path, eval, notify) == shared && notified == 0,
+	       "TravelTimeGrid::Shared reuse");
+
+	unlink (path);
+	check (!KClass::TravelTimeGrid::Load (params, path), "TravelTimeGrid missing file");
+}
+
+void
+testChannelMap ()
+{
+	KClass::ChannelMap map;
+	map.set (0, "HHN");
+	map.set (1, "HHE");
+	map.set (2, "HHZ");
+	check (map.find ("HHN") == 0 && map.find ("HHE") == 1 && map.find ("HHZ") == 2,
+	       "ChannelMap::find");
+	check (map.find ("HH") == -1 && map.find ("HHZ1") == -1 && map.find ("") == -1 &&
+	           map.find ("BHZ") == -1,
+	       "ChannelMap::find unknown");
+
+	// A code configured for several components goes to the first of them
+	map.set (1, "HHN");
+	check (map.find ("HHN") == 0, "ChannelMap duplicate");
+
+	// Codes too long to be packed are compared as strings
+	map.set (1, "LONGCODE1");
+	check (map.find ("LONGCODE1") == 1 && map.find ("LONGCODE2") == -1 &&
+	           map.find ("HHZ") == 2 && map.find ("HHN") == 0,
+	       "ChannelMap long codes");
+
+	// An unset component matches nothing, not even an empty code
+	map.clear ();
+	map.set (2, "HHZ");
+	check (map.find ("") == -1 && map.find ("HHN") == -1 && map.find ("HHZ") == 2,
+	       "ChannelMap::clear");
+}
+
+// Rectangle of latitude/longitude corners as a closed ring
+KClass::RegionIndex::Ring
+rectangle (double lat1, double lon1, double lat2, double lon2)
+{
+	return {{lat1, lon1}, {lat1, lon2}, {lat2, lon2}, {lat2, lon1}};
+}
+
+void
+testRegions (mt19937 &rng)
+{
+	KClass::RegionIndex index;
+	check (index.find (0, 0) == -1, "RegionIndex empty");
+
+	// Regions added first win where they overlap. The grid has 4 x 4 cells
+	// of 15 degrees over the bounding box [0, 60] x [0, 60].
+	index.add ({rectangle (0, 0, 20, 20)});
+	index.add ({rectangle (25, 0, 35, 35)});
+	index.add ({rectangle (40, 40, 60, 60), rectangle (45, 45, 55, 55)});
+	index.add ({rectangle (10, 10, 30, 30)});
+	index.add ({{{0, 40}, {20, 40}, {0, 60}}});
+	index.build ();
+	check (index.size () == 5, "RegionIndex::size");
+
+	check (index.find (5, 5) == 0 && index.find (27, 5) == 1 && index.find (42, 50) == 2 &&
+	           index.find (22, 22) == 3 && index.find (5, 45) == 4,
+	       "RegionIndex inside");
+	check (index.find (22, 5) == -1 && index.find (-1, 5) == -1 && index.find (61, 50) == -1 &&
+	           index.find (50, 70) == -1 && index.find (15, 58) == -1,
+	       "RegionIndex outside");
+	check (index.find (12, 12) == 0 && index.find (28, 28) == 1, "RegionIndex precedence");
+	check (index.find (50, 50) == -1 && index.find (47, 42) == 2 && index.find (57, 50) == 2,
+	       "RegionIndex hole");
+
+	// Points on cell borders and corners
+	check (index.find (15, 15) == 0 && index.find (30, 30) == 1 && index.find (45, 42) == 2 &&
+	           index.find (15, 5) == 0 && index.find (5, 15) == 0,
+	       "RegionIndex cell border");
+
+	// Brute force over the analytic shapes in precedence order
+	auto expected = [] (double lat, double lon) {
+		auto in = [lat, lon] (double lat1, double lon1, double lat2, double lon2) {
+			return lat > lat1 && lat < lat2 && lon > lon1 && lon < lon2;
+		};
+		if (in (0, 0, 20, 20))
+		{
+			return 0;
+		}
+		if (in (25, 0, 35, 35))
+		{
+			return 1;
+		}
+		if (in (40, 40, 60, 60) && !in (45, 45, 55, 55))
+		{
+			return 2;
+		}
+		if (in (10, 10, 30, 30))
+		{
+			return 3;
+		}
+		if (lat > 0 && lon > 40 && lat / 20 + (lon - 40) / 20 < 1)
+		{
+			return 4;
+		}
+		return -1;
+	};
+	uniform_real_distribution<double> coordinate (-5, 65);
+	int mismatches = 0;
+	for (int i = 0; i < 100000; ++i)
+	{
+		double lat = coordinate (rng), lon = coordinate (rng);
+		mismatches += index.find (lat, lon) != expected (lat, lon);
+	}
+	check (mismatches == 0, "RegionIndex brute force");
+
+	index.clear ();
+	index.build ();
+	check (index.size () == 0 && index.find (5, 5) == -1, "RegionIndex::clear");
+}
+
+void
+testTaskPool ()
+{
+	KClass::TaskPool pool (4);
+	check (pool.size () == 4, "TaskPool::size");
+
+	atomic<int> count{0};
+	KClass::TaskPool::Group group;
+	for (int i = 0; i < 1000; ++i)
+	{
+		pool.run (group, [&count] { ++count; });
+	}
+	pool.wait (group);
+	check (count == 1000, "TaskPool::wait");
+
+	// Tasks waiting on their own groups execute pending tasks meanwhile,
+	// so nesting does not deadlock even on a single worker
+	KClass::TaskPool single (1);
+	count = 0;
+	KClass::TaskPool::Group outer;
+	for (int i = 0; i < 8; ++i)
+	{
+		single.run (outer, [&single, &count] {
+			KClass::TaskPool::Group inner;
+			for (int j = 0; j < 8; ++j)
+			{
+				single.run (inner, [&count] { ++count; });
+			}
+			single.wait (inner);
+		});
+	}
+	single.wait (outer);
+	check (count == 64, "TaskPool nested groups");
+
+	// The first exception of a group is rethrown by wait after all its
+	// tasks are done, the pool stays usable
+	count = 0;
+	KClass::TaskPool::Group failing;
+	for (int i = 0; i < 16; ++i)
+	{
+		pool.run (failing, [&count, i] {
+			++count;
+			if (i % 4 == 0)
+			{
+				throw runtime_error ("task");
+			}
+		});
+	}
+	bool thrown = false;
+	try
+	{
+		pool.wait (failing);
+	}
+	catch (const runtime_error &)
+	{
+		thrown = true;
+	}
+	check (thrown && count == 16, "TaskPool exception");
+
+	KClass::TaskPool::Group after;
+	pool.run (after, [&count] { ++count; });
+	pool.wait (after);
+	check (count == 17, "TaskPool after exception");
+}
+
+// Value whose live instances are counted, the two copies of the version
+// differ if it is read while being destroyed
+struct Snapshot
+{
+	static atomic<int> alive;
+
+	explicit Snapshot (int version)
+		: version (version), copy (version)
+	{
+		++alive;
+	}
+
+	~Snapshot ()
+	{
+		version = copy = -1;
+		--alive;
+	}
+
+	int version, copy;
+};
+
+atomic<int> Snapshot::alive{0};
+
+void
+testPublished ()
+{
+	{
+		KClass::Published<Snapshot> published;
+		check (KClass::Published<Snapshot>::Reader (published).get () == nullptr,
+		       "Published empty");
+
+		published.publish (unique_ptr<Snapshot> (new Snapshot (1)));
+		published.publish (unique_ptr<Snapshot> (new Snapshot (2)));
+		check (Snapshot::alive == 1, "Published frees the unread value");
+
+		// A pinned value survives the publish and is freed with its reader
+		{
+			KClass::Published<Snapshot>::Reader reader (published);
+			published.publish (unique_ptr<Snapshot> (new Snapshot (3)));
+			check (Snapshot::alive == 2 && reader->version == 2, "Published pinned value");
+		}
+		check (Snapshot::alive == 1, "Published frees the value after its reader");
+
+		check (countAllocations ([&published] {
+			       KClass::Published<Snapshot>::Reader reader (published);
+			       check (reader->version == 3, "Published current value");
+		       }) == 0,
+		       "Published::Reader allocates");
+
+		// Readers see complete values of increasing versions while they are
+		// replaced, and no replaced value outlives its readers
+		atomic<bool> done{false};
+		atomic<int> errors{0};
+		vector<thread> readers;
+		for (int i = 0; i < 4; ++i)
+		{
+			readers.emplace_back ([&published, &done, &errors] {
+				int last = 0;
+				while (!done)
+				{
+					KClass::Published<Snapshot>::Reader reader (published);
+					if (reader->version != reader->copy || reader->version < last)
+					{
+						++errors;
+					}
+					last = reader->version;
+				}
+			});
+		}
+		int version = 3;
+		for (int i = 0; i < 10000; ++i)
+		{
+			published.publish (unique_ptr<Snapshot> (new Snapshot (++version)));
+			if (Snapshot::alive > 1 + static_cast<int> (readers.size ()))
+			{
+				++errors;
+			}
+		}
+		done = true;
+		for (thread &reader : readers)
+		{
+			reader.join ();
+		}
+		check (errors == 0, "Published concurrent readers");
+		check (Snapshot::alive == 1, "Published frees replaced values");
+	}
+	check (Snapshot::alive == 0, "Published frees the current value");
+}
+
+// The kernels run for every station and record must not allocate once their
+// buffers have grown to the working size
+void
+testAllocations (mt19937 &rng)
+{
+	const int n = 1 << 14;
+	normal_distribution<double> noise;
+	vector<double> data (n);
+	for (double &v : data)
+	{
+		v = noise (rng);
+	}
+
+	// Growing buffer, then reprocessing, after a reset as for a new origin
+	KClass::PeakSearch search;
+	auto searches = [&] {
+		for (int end = n / 16; end <= n; end += n / 16)
+		{
+			search.find (end, data.data (), 0, end, 0.0);
+		}
+		for (int i1 = 0; i1 < n; i1 += n / 16)
+		{
+			search.find (n, data.data (), i1, n, 0.0);
+		}
+	};
+	searches ();
+	search.reset ();
+	check (countAllocations (searches) == 0, "PeakSearch allocates");
+
+	KClass::WoodAndersonFilter filter;
+	for (int lane = 0; lane < 3; ++lane)
+	{
+		filter.setLane (lane, 100, KClass::WoodAndersonResponse ());
+	}
+	vector<double> lanes[3] = {data, data, data};
+	check (countAllocations ([&] {
+		       filter.apply (n, lanes[0].data (), lanes[1].data (), lanes[2].data ());
+		       filter.apply (0, n, lanes[0].data ());
+	       }) == 0,
+	       "WoodAndersonFilter allocates");
+
+	KClass::Calibration calibration;
+	calibration.set (1.84, {{75, 2.11, 1.32}, {INFINITY, 0, 8}});
+	vector<double> epiKm (n, 100.0), depth (n, 10.0), mag (n);
+	check (countAllocations ([&] {
+		       calibration.magnitudes (n, data.data (), epiKm.data (), depth.data (), mag.data ());
+	       }) == 0,
+	       "Calibration::magnitudes allocates");
+
+	vector<KClass::LayeredModel::Layer> layers;
+	KClass::LayeredModel model;
+	KClass::LayeredModel::Parse (KClass::LayeredModel::DefaultModel, layers);
+	model.set (layers);
+	vector<double> elevation (n, 0.1), p (n), s (n);
+	check (countAllocations ([&] {
+		       model.firstArrivals (n, epiKm.data (), elevation.data (), 12.0, p.data (), s.data ());
+	       }) == 0,
+	       "LayeredModel allocates");
+
+	// A full cache recycles its least recently used entry on insertion
+	KClass::TravelTimeCache &cache = KClass::TravelTimeCache::Instance ();
+	size_t capacity = cache.capacity ();
+	cache.setCapacity (64);
+	uint32_t table = cache.table ("coretest", "none");
+	KClass::FirstArrivals arrivals;
+	for (int i = 0; i < 64; ++i)
+	{
+		cache.insert (KClass::TravelTimeCache::makeKey (table, 10, i * 0.01, 0), arrivals);
+	}
+	check (countAllocations ([&] {
+		       for (int i = 0; i < 1000; ++i)
+		       {
+			       KClass::TravelTimeCache::Key key =
+				       KClass::TravelTimeCache::makeKey (table, 10, i * 0.01, 0);
+			       if (!cache.lookup (key, arrivals))
+			       {
+				       cache.insert (key, arrivals);
+			       }
+		       }
+	       }) == 0,
+	       "TravelTimeCache allocates");
+	check (cache.size () == 64, "TravelTimeCache size");
+	cache.clear ();
+	cache.setCapacity (capacity);
+}
+
+} // namespace
+
+
+int
+main (int argc, char **argv)
+{
+	mt19937 rng (argc > 1 ? atoi (argv[1]) : 1);
+
+	testAmplitudes ();
+	testPeaks (rng);
+	testSegments ();
+	testMagnitudes (rng);
+	testBaseline (rng);
+	testFilter (rng);
+	testTravelTimes ();
+	testTravelTimeCache ();
+	testTravelTimeGrid (rng);
+	testChannelMap ();
+	testTaskPool ();
+	testPublished ();
+	testRegions (rng);
+	testAllocations (rng);
+
+	if (failures)
+	{
+		printf ("%d checks failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
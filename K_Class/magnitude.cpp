@@ -0,0 +1,70 @@
+#include "magnitude.h"
+
+#include <cmath>
+
+
+namespace KClass
+{
+
+namespace
+{
+
+Status
+checkDomain (double amplitude, double delta, double depth)
+{
+	if ((delta < DeltaMin) || (delta > DeltaMax))
+	{
+		return DistanceOutOfRange;
+	}
+
+	if (depth > DepthMax)
+	{
+		return DepthOutOfRange;
+	}
+
+	if (amplitude <= 0.)
+	{
+		return InvalidAmplitude;
+	}
+
+	return OK;
+}
+
+} // namespace
+
+
+Status
+computeMagnitude (
+	const Calibration &calibration, double amplitude, double delta,
+	double depth, double &mag)
+{
+	Status status = checkDomain (amplitude, delta, depth);
+	if (status == InvalidAmplitude)
+	{
+		mag = 0;
+	}
+	if (status != OK)
+	{
+		return status;
+	}
+
+	double epDistKm = delta * KmPerDegree;
+	double hypDistKm = std::sqrt (epDistKm * epDistKm + depth * depth);
+	mag = calibration.magnitude (amplitude, hypDistKm);
+
+	return OK;
+}
+
+
+void
+computeMagnitudes (
+	const Calibration &calibration, size_t n, const double *amplitude,
+	const double *delta, const double *depth, double *mag, Status *status)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		status[i] = computeMagnitude (calibration, amplitude[i], delta[i], depth[i], mag[i]);
+	}
+}
+
+} // namespace KClass
@@ -0,0 +1,46 @@
+// K_Class station magnitude shared by the plugin and the offline tools
+
+#ifndef __K_Class_MAGNITUDE_H__
+#define __K_Class_MAGNITUDE_H__
+
+
+#include "calibration.h"
+
+#include <cstddef>
+
+
+namespace KClass
+{
+
+// Valid within 0-10 degrees from 0 to 80 km
+constexpr double DeltaMin = 0.0;
+constexpr double DeltaMax = 10.0;
+constexpr double DepthMax = 80.0;
+
+// Length of one degree of arc in km, equal to KM_OF_DEGREE of SeisComP
+constexpr double KmPerDegree = 111.195079734632;
+
+enum Status
+{
+	OK,
+	DistanceOutOfRange,
+	DepthOutOfRange,
+	InvalidAmplitude
+};
+
+// K_Class of one amplitude (micrometers) at an epicentral distance (deg) and
+// depth (km). mag is 0 for invalid amplitudes and untouched if out of range.
+Status
+computeMagnitude (
+	const Calibration &calibration, double amplitude, double delta,
+	double depth, double &mag);
+
+// computeMagnitude of each entry of a structure-of-arrays layout
+void
+computeMagnitudes (
+	const Calibration &calibration, size_t n, const double *amplitude,
+	const double *delta, const double *depth, double *mag, Status *status);
+
+} // namespace KClass
+
+#endif
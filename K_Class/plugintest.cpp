@@ -0,0 +1,416 @@
+// Tests of the K_Class amplitude processor
+//
+// Creates the processor through the amplitude processor factory, like
+// scamp, and checks the allocations of the per-station path: once a
+// processor of the station has been set up for an origin, setEnvironment
+// of the next one must not allocate, feeding may only allocate what
+// SeisComP allocates itself and a reprocess that reuses all results must
+// not allocate. Also checks the reload intervals of stations configured
+// differently. Exits with 1 if a check fails.
+
+#include "magnitude.h"
+#include "reload.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <seiscomp/config/config.h>
+#include <seiscomp/core/genericrecord.h>
+#include <seiscomp/core/typedarray.h>
+#include <seiscomp/datamodel/origin.h>
+#include <seiscomp/datamodel/pick.h>
+#include <seiscomp/datamodel/sensorlocation.h>
+#include <seiscomp/math/geo.h>
+#include <seiscomp/processing/amplitudeprocessor.h>
+#include <seiscomp/processing/magnitudeprocessor.h>
+#include <seiscomp/seismology/ttt.h>
+
+using namespace std;
+using namespace Seiscomp;
+
+
+namespace
+{
+
+// Heap allocations of all threads, counted by the replaced operator new
+atomic<uint64_t> allocations{0};
+
+void *
+allocate (size_t size)
+{
+	allocations.fetch_add (1, memory_order_relaxed);
+	if (void *p = malloc (size ? size : 1))
+	{
+		return p;
+	}
+	throw bad_alloc ();
+}
+
+void *
+allocate (size_t size, align_val_t alignment)
+{
+	allocations.fetch_add (1, memory_order_relaxed);
+	size_t align = static_cast<size_t> (alignment);
+	if (void *p = aligned_alloc (align, (size + align - 1) / align * align))
+	{
+		return p;
+	}
+	throw bad_alloc ();
+}
+
+} // namespace
+
+
+// All forms are replaced, so that every delete frees memory of the
+// matching new
+void *operator new (size_t size) { return allocate (size); }
+void *operator new[] (size_t size) { return allocate (size); }
+void *operator new (size_t size, align_val_t align) { return allocate (size, align); }
+void *operator new[] (size_t size, align_val_t align) { return allocate (size, align); }
+void operator delete (void *p) noexcept { free (p); }
+void operator delete[] (void *p) noexcept { free (p); }
+void operator delete (void *p, size_t) noexcept { free (p); }
+void operator delete[] (void *p, size_t) noexcept { free (p); }
+void operator delete (void *p, align_val_t) noexcept { free (p); }
+void operator delete[] (void *p, align_val_t) noexcept { free (p); }
+void operator delete (void *p, size_t, align_val_t) noexcept { free (p); }
+void operator delete[] (void *p, size_t, align_val_t) noexcept { free (p); }
+
+
+namespace
+{
+
+int failures = 0;
+
+void
+check (bool ok, const char *what)
+{
+	if (!ok)
+	{
+		printf ("FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+// Number of heap allocations of func
+template <typename Func>
+uint64_t
+countAllocations (Func func)
+{
+	uint64_t before = allocations.load (memory_order_relaxed);
+	func ();
+	return allocations.load (memory_order_relaxed) - before;
+}
+
+// Travel times of a homogeneous half space with vp 6 km/s and vs 3.5 km/s,
+// so that the test needs no travel-time tables
+class HalfSpaceTable : public TravelTimeTableInterface
+{
+  public:
+	bool setModel (const std::string &model) override { _model = model; return true; }
+	const std::string &model () const override { return _model; }
+
+	TravelTimeList *
+	compute (
+		double lat1, double lon1, double dep1, double lat2, double lon2,
+		double elev2 = 0., int ellc = 1) override
+	{
+		TravelTimeList *list = new TravelTimeList;
+		list->push_back (compute ("Pg", lat1, lon1, dep1, lat2, lon2, elev2, ellc));
+		list->push_back (compute ("Sg", lat1, lon1, dep1, lat2, lon2, elev2, ellc));
+		list->sortByTime ();
+		return list;
+	}
+
+	TravelTime
+	compute (
+		const char *phase, double lat1, double lon1, double dep1, double lat2,
+		double lon2, double elev2 = 0., int ellc = 1) override
+	{
+		double delta, az, baz;
+		Math::Geo::delazi_wgs84 (lat1, lon1, lat2, lon2, &delta, &az, &baz);
+		double x = Math::Geo::deg2km (delta);
+		double z = dep1 + elev2 * 1E-3;
+		double v = phase && phase[0] == 'S' ? 3.5 : 6.0;
+		return TravelTime (phase ? phase : "Pg", std::sqrt (x * x + z * z) / v, 0, 0, 0, 0);
+	}
+
+	TravelTime
+	computeFirst (
+		double lat1, double lon1, double dep1, double lat2, double lon2,
+		double elev2 = 0., int ellc = 1) override
+	{
+		return compute ("Pg", lat1, lon1, dep1, lat2, lon2, elev2, ellc);
+	}
+
+  private:
+	std::string _model{"halfspace"};
+};
+
+REGISTER_TRAVELTIME_TABLE (HalfSpaceTable, "kclass-test");
+
+
+// Settings keep references to the module name and the codes
+const string ModuleName = "kclass-test";
+const string Network = "XX", Station = "TEST", Location = "", Band = "HH";
+const string FastStation = "FAST", SlowStation = "SLOW";
+const char *Channels[3] = {"HHZ", "HHN", "HHE"}; // Z, N, E
+
+const double SamplingFrequency = 100.0;
+const double RecordLength = 10.0;
+
+// Origin and station 1.5 degrees apart
+const double OriginLatitude = 45.0, OriginLongitude = 10.0, OriginDepth = 10.0;
+const double StationLatitude = 46.5, StationLongitude = 10.0;
+
+// Creates the processor of the station and configures its streams like
+// scamp
+Processing::AmplitudeProcessorPtr
+createProcessor (const Config::Config &config)
+{
+	Processing::AmplitudeProcessorPtr proc =
+		Processing::AmplitudeProcessorFactory::Create ("K_Class");
+	if (!proc)
+	{
+		return proc;
+	}
+
+	Processing::WaveformProcessor::Component components[3] = {
+		Processing::WaveformProcessor::VerticalComponent,
+		Processing::WaveformProcessor::FirstHorizontalComponent,
+		Processing::WaveformProcessor::SecondHorizontalComponent};
+	for (int comp = 0; comp < 3; ++comp)
+	{
+		Processing::Stream &stream = proc->streamConfig (components[comp]);
+		stream.setCode (Channels[comp]);
+		stream.gain = 1.0;
+		stream.gainUnit = "M/S";
+	}
+
+	Processing::AmplitudeProcessor::Config cfg = proc->config ();
+	cfg.ttInterface = "kclass-test";
+	cfg.ttModel = "halfspace";
+	proc->setConfig (cfg);
+
+	Processing::Settings settings (
+		ModuleName, Network, Station, Location, Band, &config, nullptr);
+	if (!proc->setup (settings))
+	{
+		return nullptr;
+	}
+	return proc;
+}
+
+// Noise and an S wave train starting at arrival, split into records in Z,
+// N, E order
+void
+synthesize (
+	const Core::TimeWindow &tw, const Core::Time &arrival, mt19937 &rng,
+	vector<RecordPtr> &records)
+{
+	normal_distribution<double> noise (0, 1E-8);
+	size_t samplesPerRecord = lround (RecordLength * SamplingFrequency);
+	size_t samples = lround (tw.length () * SamplingFrequency);
+
+	records.clear ();
+	for (size_t offset = 0; offset < samples; offset += samplesPerRecord)
+	{
+		size_t n = min (samplesPerRecord, samples - offset);
+		Core::Time start = tw.startTime () + Core::TimeSpan (offset / SamplingFrequency);
+		for (int comp = 0; comp < 3; ++comp)
+		{
+			DoubleArray *data = new DoubleArray (static_cast<int> (n));
+			for (size_t i = 0; i < n; ++i)
+			{
+				double t = (double)(start - arrival) + i / SamplingFrequency;
+				double v = noise (rng);
+				if (t >= 0)
+				{
+					v += 1E-6 * (comp == 0 ? 0.5 : 1.0) * exp (-t / 5) * sin (2 * M_PI * 4 * t);
+				}
+				(*data)[i] = v;
+			}
+
+			GenericRecord *rec = new GenericRecord (
+				Network, Station, Location, Channels[comp], start, SamplingFrequency);
+			rec->setData (data);
+			records.push_back (rec);
+		}
+	}
+}
+
+// Allocations of the copy of a record, which WaveformProcessor::store makes
+// for every record
+uint64_t
+copyAllocations (const Record *record)
+{
+	return countAllocations ([record] { ArrayPtr copy = record->data ()->copy (Array::DOUBLE); });
+}
+
+// Allocations of the noise estimate of SeisComP, a slice of the buffered
+// data and its median, made once per component
+uint64_t
+noiseAllocations ()
+{
+	DoubleArray data (100);
+	return countAllocations ([&data] {
+		DoubleArrayPtr noise = data.slice (0, 50);
+		noise->median ();
+	});
+}
+
+// Replays one origin through two processors of the station with the
+// travel-time engine. The first one warms up the travel-time cache and the
+// lazily created state of the plugin, the second one is checked.
+void
+testStation (const char *engine, mt19937 &rng)
+{
+	Config::Config config;
+	config.setString ("amplitudes.K_Class.ttEngine", engine);
+
+	Core::Time originTime (1.7E9);
+	DataModel::OriginPtr origin = DataModel::Origin::Create ();
+	origin->setLatitude (DataModel::RealQuantity (OriginLatitude));
+	origin->setLongitude (DataModel::RealQuantity (OriginLongitude));
+	origin->setDepth (DataModel::RealQuantity (OriginDepth));
+	origin->setTime (DataModel::TimeQuantity (originTime));
+
+	DataModel::SensorLocationPtr receiver = DataModel::SensorLocation::Create ();
+	receiver->setLatitude (StationLatitude);
+	receiver->setLongitude (StationLongitude);
+	receiver->setElevation (0.0);
+
+	HalfSpaceTable table;
+	Core::Time trigger = originTime + Core::TimeSpan (table.computeFirst (
+		OriginLatitude, OriginLongitude, OriginDepth, StationLatitude, StationLongitude).time);
+	Core::Time sArrival = originTime + Core::TimeSpan (table.compute (
+		"S", OriginLatitude, OriginLongitude, OriginDepth, StationLatitude, StationLongitude).time);
+
+	DataModel::PickPtr pick = DataModel::Pick::Create ();
+	pick->setTime (DataModel::TimeQuantity (trigger));
+
+	Processing::AmplitudeProcessorPtr warm = createProcessor (config);
+	Processing::AmplitudeProcessorPtr proc = createProcessor (config);
+	check (warm && proc, "processor setup");
+	if (!warm || !proc)
+	{
+		return;
+	}
+
+	warm->setEnvironment (origin.get (), receiver.get (), pick.get ());
+	check (countAllocations ([&] {
+		       proc->setEnvironment (origin.get (), receiver.get (), pick.get ());
+	       }) == 0,
+	       "setEnvironment allocates");
+
+	double published = NAN;
+	proc->setPublishFunction (
+		[&published] (const Processing::AmplitudeProcessor *,
+		              const Processing::AmplitudeProcessor::Result &res) {
+			published = res.amplitude.value;
+		});
+	proc->setTrigger (trigger);
+	check (proc->status () <= Processing::WaveformProcessor::Finished, "setTrigger");
+
+	vector<RecordPtr> records;
+	synthesize (proc->timeWindow (), sArrival, rng, records);
+
+	// The first record of every component sets up its filter and buffer
+	uint64_t fed = 0, budget = 3 * noiseAllocations ();
+	for (size_t i = 0; i < records.size (); ++i)
+	{
+		const Record *rec = records[i].get ();
+		if (i < 3)
+		{
+			proc->feed (rec);
+			continue;
+		}
+		budget += copyAllocations (rec);
+		fed += countAllocations ([&] { proc->feed (rec); });
+	}
+	if (fed > budget)
+	{
+		printf ("%s: feed made %lu allocations, %lu by SeisComP\n", engine,
+		        (unsigned long)fed, (unsigned long)budget);
+	}
+	check (fed <= budget, "warmed up feed allocates");
+	check (!std::isnan (published), "no amplitude published");
+
+	// All components finished, so an origin update reuses their results
+	check (countAllocations ([&] { proc->reprocess (); }) == 0,
+	       "reprocess of unchanged components allocates");
+}
+
+// Magnitude processors of stations with different reload intervals poll
+// at the shortest one, and withdrawing it restarts polling at the next.
+// Without an application no poller thread runs, only the interval is
+// tracked.
+void
+testReloadIntervals ()
+{
+	Config::Config fast, slow;
+	fast.setDouble ("magnitudes.K_Class.reloadInterval", 5.0);
+	slow.setDouble ("magnitudes.K_Class.reloadInterval", 30.0);
+	Processing::Settings fastSettings (
+		ModuleName, Network, FastStation, Location, Band, &fast, nullptr);
+	Processing::Settings slowSettings (
+		ModuleName, Network, SlowStation, Location, Band, &slow, nullptr);
+
+	Processing::MagnitudeProcessorPtr a =
+		Processing::MagnitudeProcessorFactory::Create ("K_Class");
+	Processing::MagnitudeProcessorPtr b =
+		Processing::MagnitudeProcessorFactory::Create ("K_Class");
+	check (a && b, "magnitude processor creation");
+	if (!a || !b)
+	{
+		return;
+	}
+
+	check (a->setup (slowSettings) && KClass::ConfigReloader::Interval () == 30.0,
+	       "reload interval of the first station");
+	check (b->setup (fastSettings) && KClass::ConfigReloader::Interval () == 5.0,
+	       "shorter reload interval of another station");
+	check (a->setup (fastSettings) && KClass::ConfigReloader::Interval () == 5.0,
+	       "reload interval requested twice");
+	b = nullptr;
+	check (KClass::ConfigReloader::Interval () == 5.0, "reload interval still requested");
+	check (a->setup (slowSettings) && KClass::ConfigReloader::Interval () == 30.0,
+	       "reload interval after reconfiguration");
+	a = nullptr;
+	check (KClass::ConfigReloader::Interval () == 0.0, "reload interval without stations");
+
+	int first, second;
+	KClass::ConfigReloader::Start (&first, 10.0);
+	KClass::ConfigReloader::Start (&second, 20.0);
+	KClass::ConfigReloader::Start (&first, 0.0);
+	check (KClass::ConfigReloader::Interval () == 20.0, "withdrawn reload interval");
+	KClass::ConfigReloader::Remove (&second);
+	check (KClass::ConfigReloader::Interval () == 0.0, "removed reload interval");
+}
+
+} // namespace
+
+
+int
+main (int argc, char **argv)
+{
+	mt19937 rng (argc > 1 ? atoi (argv[1]) : 1);
+
+	testStation ("table", rng);
+	testStation ("layered", rng);
+	testReloadIntervals ();
+
+	if (failures)
+	{
+		printf ("%d checks failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,45 @@
+#include "profiles.h"
+
+
+namespace KClass
+{
+
+namespace
+{
+
+const Profile Profiles[] = {
+	ProfileKernel<WSG2020>::Make (),
+};
+
+} // namespace
+
+
+const Profile *
+findProfile (const std::string &name)
+{
+	for (const Profile &profile : Profiles)
+	{
+		if (name == profile.name)
+		{
+			return &profile;
+		}
+	}
+
+	return nullptr;
+}
+
+
+std::string
+profileNames ()
+{
+	std::string names;
+	for (const Profile &profile : Profiles)
+	{
+		names += names.empty () ? "" : ", ";
+		names += profile.name;
+	}
+
+	return names;
+}
+
+} // namespace KClass
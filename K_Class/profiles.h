@@ -0,0 +1,112 @@
+// Built-in K_Class calibrations
+
+#ifndef __K_Class_PROFILES_H__
+#define __K_Class_PROFILES_H__
+
+
+#include "calibration.h"
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+
+namespace KClass
+{
+
+// Coefficient tables of the built-in profiles. A profile is a struct with
+// the constexpr members Name, A and Segments (as for Calibration::set, the
+// upper bound of the last segment is ignored). The name carries the
+// version, a revised calibration is added as a new profile.
+
+// WSG software, A.P. Akimov et al., 2020. The defaults of the individual
+// coefficients.
+struct WSG2020
+{
+	static constexpr const char *Name = "WSG2020";
+	static constexpr double A = 1.84;
+	static constexpr Calibration::Segment Segments[] = {
+		{75.0, 2.11, 1.32}, {264.0, 1.1, 3.21}, {800.0, 2.98, -1.34}, {INFINITY, 0.0, 8.0}};
+};
+
+// Calibration kernels of profile P. The coefficients are compile-time
+// constants, the segment search is unrolled over the known corners. The
+// operations and their order are those of Calibration, so the results are
+// bit-identical to a Calibration set from the same table.
+template <typename P>
+struct ProfileKernel
+{
+	static constexpr size_t SegmentCount = sizeof (P::Segments) / sizeof (P::Segments[0]);
+
+	struct Table
+	{
+		double corners[SegmentCount];
+		double slopes[SegmentCount];      // A * a_i
+		double intercepts[SegmentCount];  // A * b_i
+	};
+
+	static constexpr Table
+	MakeTable ()
+	{
+		Table t{};
+		for (size_t i = 0; i < SegmentCount; ++i)
+		{
+			t.corners[i] = P::Segments[i].upper;
+			t.slopes[i] = P::A * P::Segments[i].slope;
+			t.intercepts[i] = P::A * P::Segments[i].intercept;
+		}
+		return t;
+	}
+
+	static constexpr Table Coefficients = MakeTable ();
+
+	static_assert (SegmentCount > 0, "a profile needs at least one segment");
+
+	// Number of corners < R
+	static size_t
+	segment (double R)
+	{
+		size_t seg = 0;
+		for (size_t k = 0; k + 1 < SegmentCount; ++k)
+		{
+			seg += Coefficients.corners[k] < R;
+		}
+		return seg;
+	}
+
+	static double
+	magnitude (double amplitude, double R)
+	{
+		size_t i = segment (R);
+		return P::A * std::log10 (amplitude) +
+		       (Coefficients.slopes[i] * std::log10 (R) + Coefficients.intercepts[i]);
+	}
+
+	static void
+	magnitudes (
+		size_t n, const double *amplitude, const double *epiKm,
+		const double *depth, double *mag)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			double R = std::sqrt (epiKm[i] * epiKm[i] + depth[i] * depth[i]);
+			mag[i] = magnitude (amplitude[i], R);
+		}
+	}
+
+	static constexpr Profile
+	Make ()
+	{
+		return Profile{P::Name, P::A, P::Segments, SegmentCount, &magnitude, &magnitudes};
+	}
+};
+
+// Built-in profile of that name, null if there is none
+const Profile *findProfile (const std::string &name);
+
+// Names of all built-in profiles, comma separated
+std::string profileNames ();
+
+} // namespace KClass
+
+#endif
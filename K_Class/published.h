@@ -0,0 +1,59 @@
+// Immutable values replaced as a whole while other threads read them
+
+#ifndef __K_Class_PUBLISHED_H__
+#define __K_Class_PUBLISHED_H__
+
+
+#include <memory>
+#include <utility>
+
+
+namespace KClass
+{
+
+// Immutable value replaced as a whole by a reload while other threads read
+// it. Readers share ownership of the value they pinned, so a replaced value
+// is freed as soon as the publish and the last reader using it are done.
+// Pinning neither allocates nor waits for a publish, the atomic shared_ptr
+// operations only briefly lock a mutex of the standard library.
+template <typename T>
+class Published
+{
+  public:
+	// Pins the current value for the lifetime of the reader
+	class Reader
+	{
+	  public:
+		explicit Reader (const Published &published)
+			: _value (std::atomic_load (&published._current))
+		{
+		}
+
+		Reader (const Reader &) = delete;
+		Reader &operator= (const Reader &) = delete;
+
+		const T *get () const { return _value.get (); }
+		const T *operator-> () const { return _value.get (); }
+
+	  private:
+		std::shared_ptr<const T> _value;
+	};
+
+	Published () = default;
+	Published (const Published &) = delete;
+	Published &operator= (const Published &) = delete;
+
+	// Replaces the value, the previous one is freed here unless a reader
+	// still pins it
+	void publish (std::unique_ptr<const T> value)
+	{
+		std::atomic_store (&_current, std::shared_ptr<const T> (std::move (value)));
+	}
+
+  private:
+	std::shared_ptr<const T> _current;
+};
+
+} // namespace KClass
+
+#endif
@@ -0,0 +1,532 @@
+// Offline recomputation of station and network K_Class
+//
+// Reads station amplitudes with epicentral distance and depth from a CSV
+// file or a SeisComP XML export and recomputes the magnitudes with a given
+// calibration on all cores. Used to evaluate calibration changes on whole
+// catalogs without scmag replays.
+
+#include "calibration.h"
+#include "magnitude.h"
+#include "profiles.h"
+#include "taskpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <seiscomp/datamodel/amplitude.h>
+#include <seiscomp/datamodel/arrival.h>
+#include <seiscomp/datamodel/eventparameters.h>
+#include <seiscomp/datamodel/origin.h>
+#include <seiscomp/datamodel/stationmagnitude.h>
+#include <seiscomp/io/archive/xmlarchive.h>
+
+using namespace std;
+using namespace Seiscomp;
+
+
+namespace
+{
+
+// Station amplitudes in structure-of-arrays layout
+struct Catalog
+{
+	vector<string> origins;     // origin ids, indexed by origin
+	vector<size_t> origin;      // origin index of each amplitude
+	vector<string> station;
+	vector<double> amplitude;   // micrometers
+	vector<double> delta;       // degrees
+	vector<double> depth;       // km
+
+	size_t size () const { return amplitude.size (); }
+
+	size_t
+	originIndex (const string &id, map<string, size_t> &index)
+	{
+		auto it = index.find (id);
+		if (it != index.end ())
+		{
+			return it->second;
+		}
+		index[id] = origins.size ();
+		origins.push_back (id);
+		return origins.size () - 1;
+	}
+};
+
+struct Options
+{
+	string input;
+	string format;
+	string output;
+	string network;
+	string segments;
+	string profile;
+	unsigned threads = thread::hardware_concurrency ();
+	double A = 1.84;
+	double a[4] = {2.11, 1.1, 2.98, 0.0};
+	double b[4] = {1.32, 3.21, -1.34, 8.0};
+	double l[3] = {75.0, 264.0, 800.0};
+};
+
+void
+usage ()
+{
+	cerr << "Usage: kclass-recompute [options] input" << endl
+	     << endl
+	     << "Input is a CSV file with the columns origin, station, amplitude (um)," << endl
+	     << "delta (deg) and depth (km) or a SeisComP XML file with origins," << endl
+	     << "arrivals, amplitudes and K_Class station magnitudes." << endl
+	     << endl
+	     << "Options:" << endl
+	     << "  --format csv|xml     input format (default: from the file extension)" << endl
+	     << "  --output file        station magnitudes (default: stdout)" << endl
+	     << "  --network file       network magnitudes per origin" << endl
+	     << "  --threads n          worker threads (default: all cores)" << endl
+	     << "  --A, --a1..--a4, --b1..--b4, --l1..--l3 value" << endl
+	     << "                       calibration coefficients (default: WSG)" << endl
+	     << "  --segments table     upper:slope:intercept list replacing a, b and l" << endl
+	     << "  --profile name       built-in calibration replacing all of the above" << endl
+	     << "                       (" << KClass::profileNames () << ")" << endl;
+}
+
+bool
+parseOptions (int argc, char **argv, Options &opts)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (arg == "-h" || arg == "--help")
+		{
+			return false;
+		}
+
+		if (arg.compare (0, 2, "--") != 0)
+		{
+			if (!opts.input.empty ())
+			{
+				return false;
+			}
+			opts.input = arg;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			cerr << "Missing value of " << arg << endl;
+			return false;
+		}
+
+		string value = argv[++i];
+		string name = arg.substr (2);
+		char *end;
+		double number = strtod (value.c_str (), &end);
+		bool isNumber = *end == '\0' && end != value.c_str ();
+
+		if (name == "format")
+			opts.format = value;
+		else if (name == "output")
+			opts.output = value;
+		else if (name == "network")
+			opts.network = value;
+		else if (name == "segments")
+			opts.segments = value;
+		else if (name == "profile")
+			opts.profile = value;
+		else if (name == "threads" && isNumber && number >= 1)
+			opts.threads = static_cast<unsigned> (number);
+		else if (name == "A" && isNumber)
+			opts.A = number;
+		else if (name.size () == 2 && name[0] == 'a' && name[1] >= '1' && name[1] <= '4' && isNumber)
+			opts.a[name[1] - '1'] = number;
+		else if (name.size () == 2 && name[0] == 'b' && name[1] >= '1' && name[1] <= '4' && isNumber)
+			opts.b[name[1] - '1'] = number;
+		else if (name.size () == 2 && name[0] == 'l' && name[1] >= '1' && name[1] <= '3' && isNumber)
+			opts.l[name[1] - '1'] = number;
+		else
+		{
+			cerr << "Invalid option " << arg << " " << value << endl;
+			return false;
+		}
+	}
+
+	if (opts.input.empty ())
+	{
+		return false;
+	}
+
+	if (opts.format.empty ())
+	{
+		size_t dot = opts.input.rfind ('.');
+		string ext = dot == string::npos ? string () : opts.input.substr (dot + 1);
+		opts.format = ext == "xml" ? "xml" : "csv";
+	}
+
+	return true;
+}
+
+bool
+readCSV (const string &file, Catalog &catalog)
+{
+	ifstream ifs (file.c_str ());
+	if (!ifs)
+	{
+		cerr << "Unable to open " << file << endl;
+		return false;
+	}
+
+	map<string, size_t> origins;
+	string line;
+	size_t lineNumber = 0;
+	while (getline (ifs, line))
+	{
+		++lineNumber;
+		if (!line.empty () && line[line.size () - 1] == '\r')
+		{
+			line.erase (line.size () - 1);
+		}
+		if (line.empty () || line[0] == '#')
+		{
+			continue;
+		}
+
+		vector<string> columns;
+		stringstream ss (line);
+		string column;
+		while (getline (ss, column, ','))
+		{
+			columns.push_back (column);
+		}
+
+		double values[3];
+		bool valid = columns.size () == 5;
+		for (int i = 0; valid && i < 3; ++i)
+		{
+			char *end;
+			values[i] = strtod (columns[i + 2].c_str (), &end);
+			valid = end != columns[i + 2].c_str ();
+		}
+
+		if (!valid)
+		{
+			// Tolerate a header line
+			if (catalog.size () == 0 && lineNumber == 1)
+			{
+				continue;
+			}
+			cerr << file << ":" << lineNumber << ": invalid line" << endl;
+			return false;
+		}
+
+		catalog.origin.push_back (catalog.originIndex (columns[0], origins));
+		catalog.station.push_back (columns[1]);
+		catalog.amplitude.push_back (values[0]);
+		catalog.delta.push_back (values[1]);
+		catalog.depth.push_back (values[2]);
+	}
+
+	return true;
+}
+
+bool
+readXML (const string &file, Catalog &catalog)
+{
+	IO::XMLArchive ar;
+	if (!ar.open (file.c_str ()))
+	{
+		cerr << "Unable to open " << file << endl;
+		return false;
+	}
+
+	DataModel::EventParametersPtr ep;
+	ar >> ep;
+	ar.close ();
+
+	if (!ep)
+	{
+		cerr << file << ": no event parameters found" << endl;
+		return false;
+	}
+
+	map<string, DataModel::Amplitude *> amplitudes;
+	for (size_t i = 0; i < ep->amplitudeCount (); ++i)
+	{
+		DataModel::Amplitude *amp = ep->amplitude (i);
+		amplitudes[amp->publicID ()] = amp;
+	}
+
+	map<string, size_t> origins;
+	for (size_t i = 0; i < ep->originCount (); ++i)
+	{
+		DataModel::Origin *org = ep->origin (i);
+		double depth;
+		try {
+			depth = org->depth ().value ();
+		}
+		catch ( ... ) {
+			continue;
+		}
+
+		// The distance of an amplitude comes from the arrival of its pick
+		map<string, double> distances;
+		for (size_t j = 0; j < org->arrivalCount (); ++j)
+		{
+			DataModel::Arrival *arr = org->arrival (j);
+			try {
+				distances[arr->pickID ()] = arr->distance ();
+			}
+			catch ( ... ) {}
+		}
+
+		for (size_t j = 0; j < org->stationMagnitudeCount (); ++j)
+		{
+			DataModel::StationMagnitude *sm = org->stationMagnitude (j);
+			if (sm->type () != "K_Class")
+			{
+				continue;
+			}
+
+			auto it = amplitudes.find (sm->amplitudeID ());
+			if (it == amplitudes.end ())
+			{
+				continue;
+			}
+
+			DataModel::Amplitude *amp = it->second;
+			auto dit = distances.find (amp->pickID ());
+			if (dit == distances.end ())
+			{
+				continue;
+			}
+
+			double value;
+			string station;
+			try {
+				value = amp->amplitude ().value ();
+				station = amp->waveformID ().networkCode () + "." +
+				          amp->waveformID ().stationCode ();
+			}
+			catch ( ... ) {
+				continue;
+			}
+
+			catalog.origin.push_back (catalog.originIndex (org->publicID (), origins));
+			catalog.station.push_back (station);
+			catalog.amplitude.push_back (value);
+			catalog.delta.push_back (dit->second);
+			catalog.depth.push_back (depth);
+		}
+	}
+
+	return true;
+}
+
+// Mean below four stations, 25 % trimmed mean otherwise
+void
+networkMagnitude (vector<double> &values, double &mean, double &stdev, size_t &count)
+{
+	sort (values.begin (), values.end ());
+	size_t trim = values.size () < 4 ? 0 : values.size () / 8;
+
+	double sum = 0, sum2 = 0;
+	count = values.size () - 2 * trim;
+	for (size_t i = trim; i < values.size () - trim; ++i)
+	{
+		sum += values[i];
+		sum2 += values[i] * values[i];
+	}
+
+	mean = sum / count;
+	stdev = count > 1 ? sqrt (max (0.0, (sum2 - sum * mean) / (count - 1))) : 0.0;
+}
+
+const char *
+statusName (KClass::Status status)
+{
+	switch (status)
+	{
+	case KClass::OK:
+		return "OK";
+	case KClass::DistanceOutOfRange:
+		return "DistanceOutOfRange";
+	case KClass::DepthOutOfRange:
+		return "DepthOutOfRange";
+	default:
+		break;
+	}
+
+	return "InvalidAmplitude";
+}
+
+} // namespace
+
+
+int
+main (int argc, char **argv)
+{
+	Options opts;
+	if (!parseOptions (argc, argv, opts))
+	{
+		usage ();
+		return 1;
+	}
+
+	KClass::Calibration calibration;
+	vector<KClass::Calibration::Segment> segments;
+	if (!opts.profile.empty ())
+	{
+		const KClass::Profile *profile = KClass::findProfile (opts.profile);
+		if (!profile)
+		{
+			cerr << "Unknown profile " << opts.profile << ", expected one of "
+			     << KClass::profileNames () << endl;
+			return 1;
+		}
+		calibration.set (*profile);
+	}
+	else if (opts.segments.empty ())
+	{
+		segments = {{opts.l[0], opts.a[0], opts.b[0]}, {opts.l[1], opts.a[1], opts.b[1]},
+		            {opts.l[2], opts.a[2], opts.b[2]}, {INFINITY, opts.a[3], opts.b[3]}};
+	}
+	else if (!KClass::Calibration::ParseSegments (opts.segments, segments))
+	{
+		cerr << "Invalid segment table: " << opts.segments << endl;
+		return 1;
+	}
+
+	if (opts.profile.empty () && !calibration.set (opts.A, segments))
+	{
+		cerr << "Corner distances must be increasing" << endl;
+		return 1;
+	}
+
+	Catalog catalog;
+	if (!(opts.format == "xml" ? readXML (opts.input, catalog) : readCSV (opts.input, catalog)))
+	{
+		return 1;
+	}
+
+	size_t n = catalog.size ();
+	vector<double> mag (n);
+	vector<KClass::Status> status (n);
+
+	KClass::TaskPool pool (opts.threads);
+
+	// Station magnitudes in independent chunks
+	{
+		const size_t chunk = 65536;
+		KClass::TaskPool::Group group;
+		for (size_t offset = 0; offset < n; offset += chunk)
+		{
+			size_t m = min (chunk, n - offset);
+			pool.run (group, [&, offset, m] {
+				KClass::computeMagnitudes (
+					calibration, m, &catalog.amplitude[offset], &catalog.delta[offset],
+					&catalog.depth[offset], &mag[offset], &status[offset]);
+			});
+		}
+		pool.wait (group);
+	}
+
+	// Network magnitudes per origin
+	vector<vector<size_t>> members (catalog.origins.size ());
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (status[i] == KClass::OK)
+		{
+			members[catalog.origin[i]].push_back (i);
+		}
+	}
+
+	vector<double> netMag (members.size ()), netStdev (members.size ());
+	vector<size_t> netCount (members.size ());
+	{
+		const size_t chunk = 1024;
+		KClass::TaskPool::Group group;
+		for (size_t offset = 0; offset < members.size (); offset += chunk)
+		{
+			size_t end = min (members.size (), offset + chunk);
+			pool.run (group, [&, offset, end] {
+				vector<double> values;
+				for (size_t o = offset; o < end; ++o)
+				{
+					netCount[o] = 0;
+					if (members[o].empty ())
+					{
+						continue;
+					}
+					values.clear ();
+					for (size_t i : members[o])
+					{
+						values.push_back (mag[i]);
+					}
+					networkMagnitude (values, netMag[o], netStdev[o], netCount[o]);
+				}
+			});
+		}
+		pool.wait (group);
+	}
+
+	ofstream ofs;
+	if (!opts.output.empty ())
+	{
+		ofs.open (opts.output.c_str ());
+		if (!ofs)
+		{
+			cerr << "Unable to create " << opts.output << endl;
+			return 1;
+		}
+	}
+	ostream &out = opts.output.empty () ? cout : ofs;
+
+	char buf[64];
+	out << "origin,station,amplitude,delta,depth,K,status" << '\n';
+	for (size_t i = 0; i < n; ++i)
+	{
+		out << catalog.origins[catalog.origin[i]] << ',' << catalog.station[i] << ','
+		    << catalog.amplitude[i] << ',' << catalog.delta[i] << ','
+		    << catalog.depth[i] << ',';
+		if (status[i] == KClass::OK)
+		{
+			snprintf (buf, sizeof (buf), "%.2f", mag[i]);
+			out << buf;
+		}
+		out << ',' << statusName (status[i]) << '\n';
+	}
+
+	if (!opts.network.empty ())
+	{
+		ofstream net (opts.network.c_str ());
+		if (!net)
+		{
+			cerr << "Unable to create " << opts.network << endl;
+			return 1;
+		}
+
+		net << "origin,K,stdev,count" << '\n';
+		for (size_t o = 0; o < members.size (); ++o)
+		{
+			if (!netCount[o])
+			{
+				continue;
+			}
+			snprintf (buf, sizeof (buf), "%.2f,%.2f,%zu", netMag[o], netStdev[o], netCount[o]);
+			net << catalog.origins[o] << ',' << buf << '\n';
+		}
+	}
+
+	cerr << n << " amplitudes of " << catalog.origins.size () << " origins recomputed with "
+	     << pool.size () << " threads" << endl;
+
+	return 0;
+}
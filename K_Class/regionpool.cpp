@@ -0,0 +1,166 @@
+#include "regionpool.h"
+
+#include <seiscomp/geo/featureset.h>
+
+#include <sys/stat.h>
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+
+namespace KClass
+{
+
+namespace
+{
+
+// Path, modification time (ns) and size of a file
+typedef std::tuple<std::string, long long, long long> FileKey;
+typedef std::pair<const RegionFile *, std::vector<size_t>> IndexKey;
+
+// An index keeps its file alive, so the address in its key cannot be
+// reused by another file while the entry is in use
+struct SharedIndex
+{
+	std::shared_ptr<const RegionFile> file;
+	RegionIndex index;
+};
+
+std::mutex poolMutex;
+std::map<FileKey, std::weak_ptr<const RegionFile>> files;
+std::map<IndexKey, std::weak_ptr<const RegionIndex>> indexes;
+
+template <typename Map>
+void
+dropExpired (Map &map)
+{
+	for (auto it = map.begin (); it != map.end ();)
+	{
+		it = it->second.expired () ? map.erase (it) : std::next (it);
+	}
+}
+
+std::shared_ptr<const RegionFile>
+parse (const std::string &path)
+{
+	Seiscomp::Geo::GeoFeatureSet features;
+	if (features.readFile (path, nullptr) < 0)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<RegionFile> file = std::make_shared<RegionFile> ();
+	for (const Seiscomp::Geo::GeoFeature *feature : features.features ())
+	{
+		if (!feature->closedPolygon () || feature->name ().empty ())
+		{
+			continue;
+		}
+
+		// Sub features start new rings of the same region
+		const std::vector<Seiscomp::Geo::GeoCoordinate> &vertices = feature->vertices ();
+		std::vector<size_t> starts (feature->subFeatures ());
+		starts.push_back (vertices.size ());
+		std::vector<RegionIndex::Ring> rings;
+		size_t begin = 0;
+		for (size_t end : starts)
+		{
+			if (end > begin)
+			{
+				RegionIndex::Ring ring;
+				for (size_t i = begin; i < end; ++i)
+				{
+					ring.push_back ({vertices[i].lat, vertices[i].lon});
+				}
+				rings.push_back (ring);
+			}
+			begin = end;
+		}
+
+		file->names.push_back (feature->name ());
+		file->rings.push_back (rings);
+	}
+
+	return file;
+}
+
+} // namespace
+
+
+std::shared_ptr<const RegionFile>
+RegionPool::Read (const std::string &path)
+{
+	struct stat st;
+	if (stat (path.c_str (), &st) != 0)
+	{
+		return nullptr;
+	}
+	FileKey key (path,
+	             static_cast<long long> (st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+	             static_cast<long long> (st.st_size));
+
+	// Parsing under the lock makes the processors set up meanwhile wait for
+	// this copy instead of reading their own
+	std::lock_guard<std::mutex> lock (poolMutex);
+	auto it = files.find (key);
+	if (it != files.end ())
+	{
+		if (std::shared_ptr<const RegionFile> file = it->second.lock ())
+		{
+			return file;
+		}
+	}
+
+	std::shared_ptr<const RegionFile> file = parse (path);
+	if (file)
+	{
+		dropExpired (files);
+		files[key] = file;
+	}
+	return file;
+}
+
+
+std::shared_ptr<const RegionIndex>
+RegionPool::Index (
+	const std::shared_ptr<const RegionFile> &file, const std::vector<size_t> &regions)
+{
+	IndexKey key (file.get (), regions);
+
+	std::lock_guard<std::mutex> lock (poolMutex);
+	auto it = indexes.find (key);
+	if (it != indexes.end ())
+	{
+		if (std::shared_ptr<const RegionIndex> index = it->second.lock ())
+		{
+			return index;
+		}
+	}
+
+	std::shared_ptr<SharedIndex> shared = std::make_shared<SharedIndex> ();
+	shared->file = file;
+	for (size_t region : regions)
+	{
+		shared->index.add (file->rings[region]);
+	}
+	shared->index.build ();
+
+	std::shared_ptr<const RegionIndex> index (shared, &shared->index);
+	dropExpired (indexes);
+	indexes[key] = index;
+	return index;
+}
+
+
+size_t
+RegionPool::Size ()
+{
+	std::lock_guard<std::mutex> lock (poolMutex);
+	dropExpired (files);
+	dropExpired (indexes);
+	return files.size () + indexes.size ();
+}
+
+} // namespace KClass
@@ -0,0 +1,45 @@
+// Registry of shared calibration region files
+
+#ifndef __K_Class_REGIONPOOL_H__
+#define __K_Class_REGIONPOOL_H__
+
+
+#include "regions.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace KClass
+{
+
+// Named closed polygons of a region file, in file order
+struct RegionFile
+{
+	std::vector<std::string> names;
+	std::vector<std::vector<RegionIndex::Ring>> rings;
+};
+
+// Process-wide pool of parsed region files and their indexes. One magnitude
+// processor is set up per station, so instances share one copy of each file
+// and one index per file and selection of regions instead of building their
+// own at every setup and reload. A file is read again once it changed on
+// disk. Entries are released with their last user.
+class RegionPool
+{
+  public:
+	// Returns nullptr if the file cannot be read
+	static std::shared_ptr<const RegionFile> Read (const std::string &path);
+
+	// Index over the given regions of the file, in this order
+	static std::shared_ptr<const RegionIndex>
+	Index (const std::shared_ptr<const RegionFile> &file, const std::vector<size_t> &regions);
+
+	// Number of files and indexes in use
+	static size_t Size ();
+};
+
+} // namespace KClass
+
+#endif
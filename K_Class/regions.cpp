@@ -0,0 +1,185 @@
+#include "regions.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace KClass
+{
+
+size_t
+RegionIndex::add (const std::vector<Ring> &rings)
+{
+	Region region;
+	region.rings = rings;
+	region.minLat = region.minLon = HUGE_VAL;
+	region.maxLat = region.maxLon = -HUGE_VAL;
+	for (const Ring &ring : rings)
+	{
+		for (const Vertex &v : ring)
+		{
+			region.minLat = std::min (region.minLat, v.lat);
+			region.maxLat = std::max (region.maxLat, v.lat);
+			region.minLon = std::min (region.minLon, v.lon);
+			region.maxLon = std::max (region.maxLon, v.lon);
+		}
+	}
+
+	_regions.push_back (region);
+	return _regions.size () - 1;
+}
+
+
+void
+RegionIndex::build ()
+{
+	_cellStart.clear ();
+	_cellRegions.clear ();
+	_nLat = _nLon = 0;
+
+	double minLat = HUGE_VAL, maxLat = -HUGE_VAL;
+	double minLon = HUGE_VAL, maxLon = -HUGE_VAL;
+	for (const Region &region : _regions)
+	{
+		if (region.minLat > region.maxLat)
+		{
+			continue;
+		}
+		minLat = std::min (minLat, region.minLat);
+		maxLat = std::max (maxLat, region.maxLat);
+		minLon = std::min (minLon, region.minLon);
+		maxLon = std::max (maxLon, region.maxLon);
+	}
+
+	if (minLat > maxLat)
+	{
+		return;
+	}
+
+	// About four cells per region keep the candidate lists short for
+	// typical, mostly disjoint regionalizations
+	int n = std::min (1024, std::max (1, static_cast<int> (std::ceil (
+		2 * std::sqrt (static_cast<double> (_regions.size ()))))));
+	_nLat = _nLon = n;
+	_minLat = minLat;
+	_minLon = minLon;
+	_cellLat = std::max (maxLat - minLat, 1E-6) / n;
+	_cellLon = std::max (maxLon - minLon, 1E-6) / n;
+
+	auto cellRange = [] (double lo, double hi, double origin, double size, int count,
+	                     int &c1, int &c2) {
+		c1 = std::min (count - 1, std::max (0, static_cast<int> ((lo - origin) / size)));
+		c2 = std::min (count - 1, std::max (0, static_cast<int> ((hi - origin) / size)));
+	};
+
+	// Count, then fill the compressed cell lists
+	std::vector<size_t> counts (static_cast<size_t> (_nLat) * _nLon + 1, 0);
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (size_t r = 0; r < _regions.size (); ++r)
+		{
+			const Region &region = _regions[r];
+			if (region.minLat > region.maxLat)
+			{
+				continue;
+			}
+
+			int lat1, lat2, lon1, lon2;
+			cellRange (region.minLat, region.maxLat, _minLat, _cellLat, _nLat, lat1, lat2);
+			cellRange (region.minLon, region.maxLon, _minLon, _cellLon, _nLon, lon1, lon2);
+			for (int i = lat1; i <= lat2; ++i)
+			{
+				for (int j = lon1; j <= lon2; ++j)
+				{
+					size_t cell = static_cast<size_t> (i) * _nLon + j;
+					if (pass == 0)
+					{
+						++counts[cell + 1];
+					}
+					else
+					{
+						_cellRegions[counts[cell]++] = static_cast<int> (r);
+					}
+				}
+			}
+		}
+
+		if (pass == 0)
+		{
+			for (size_t c = 1; c < counts.size (); ++c)
+			{
+				counts[c] += counts[c - 1];
+			}
+			_cellStart = counts;
+			_cellRegions.resize (counts.back ());
+		}
+	}
+}
+
+
+void
+RegionIndex::clear ()
+{
+	_regions.clear ();
+	_cellStart.clear ();
+	_cellRegions.clear ();
+	_nLat = _nLon = 0;
+}
+
+
+int
+RegionIndex::find (double lat, double lon) const
+{
+	if (_nLat == 0)
+	{
+		return -1;
+	}
+
+	double y = (lat - _minLat) / _cellLat;
+	double x = (lon - _minLon) / _cellLon;
+	if (!(y >= 0) || !(x >= 0) || y > _nLat || x > _nLon)
+	{
+		return -1;
+	}
+
+	size_t cell = static_cast<size_t> (std::min (static_cast<int> (y), _nLat - 1)) * _nLon +
+	              std::min (static_cast<int> (x), _nLon - 1);
+	for (size_t i = _cellStart[cell]; i < _cellStart[cell + 1]; ++i)
+	{
+		const Region &region = _regions[_cellRegions[i]];
+		if (lat >= region.minLat && lat <= region.maxLat && lon >= region.minLon &&
+		    lon <= region.maxLon && Contains (region, lat, lon))
+		{
+			return _cellRegions[i];
+		}
+	}
+
+	return -1;
+}
+
+
+bool
+RegionIndex::Contains (const Region &region, double lat, double lon)
+{
+	// Even-odd rule over all rings, counting crossings of a ray towards
+	// increasing longitude
+	bool inside = false;
+	for (const Ring &ring : region.rings)
+	{
+		size_t n = ring.size ();
+		for (size_t i = 0, j = n - 1; i < n; j = i++)
+		{
+			const Vertex &a = ring[i];
+			const Vertex &b = ring[j];
+			if ((a.lat > lat) != (b.lat > lat) &&
+			    lon < (b.lon - a.lon) * (lat - a.lat) / (b.lat - a.lat) + a.lon)
+			{
+				inside = !inside;
+			}
+		}
+	}
+
+	return inside;
+}
+
+} // namespace KClass
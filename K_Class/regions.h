@@ -0,0 +1,67 @@
+// Polygon regions with a spatial index
+
+#ifndef __K_Class_REGIONS_H__
+#define __K_Class_REGIONS_H__
+
+
+#include <cstddef>
+#include <vector>
+
+
+namespace KClass
+{
+
+// Set of polygon regions, each made of one or more closed rings of
+// latitude/longitude vertices (degrees). A point is inside a region if it
+// is inside an odd number of its rings, so holes and multi-part regions
+// work. Lookups go through a uniform grid over the region bounding boxes
+// and only test the regions whose box overlaps the cell of the point.
+// Regions crossing the antimeridian have to be split.
+class RegionIndex
+{
+  public:
+	struct Vertex
+	{
+		double lat;
+		double lon;
+	};
+
+	typedef std::vector<Vertex> Ring;
+
+	// Adds a region, regions added earlier take precedence where they
+	// overlap. Returns the index of the region.
+	size_t add (const std::vector<Ring> &rings);
+
+	// Builds the grid, required after adding regions
+	void build ();
+
+	void clear ();
+
+	size_t size () const { return _regions.size (); }
+
+	// Index of the first region containing the point, -1 if none
+	int find (double lat, double lon) const;
+
+  private:
+	struct Region
+	{
+		std::vector<Ring> rings;
+		double minLat, maxLat, minLon, maxLon;
+	};
+
+	static bool Contains (const Region &region, double lat, double lon);
+
+	std::vector<Region> _regions;
+
+	double _minLat{0}, _minLon{0};
+	double _cellLat{1}, _cellLon{1};
+	int _nLat{0}, _nLon{0};
+	// Regions of cell c are _cellRegions[_cellStart[c] .. _cellStart[c + 1]),
+	// in precedence order
+	std::vector<size_t> _cellStart;
+	std::vector<int> _cellRegions;
+};
+
+} // namespace KClass
+
+#endif
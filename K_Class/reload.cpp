@@ -0,0 +1,258 @@
+#include "reload.h"
+
+#include <seiscomp/client/application.h>
+#include <seiscomp/logging/log.h>
+#include <seiscomp/system/environment.h>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace KClass
+{
+
+namespace
+{
+
+typedef std::pair<long long, long long> FileStamp;
+
+// Listeners outlive the poller, which may still run during static
+// destruction
+struct Listeners
+{
+	std::mutex mutex;
+	std::map<const void *, ConfigReloader::Listener> listeners;
+};
+
+Listeners &
+listeners ()
+{
+	static Listeners *instance = new Listeners;
+	return *instance;
+}
+
+// Modification time and size of the file, (-1, -1) if it does not exist
+FileStamp
+stamp (const std::string &path)
+{
+	struct stat st;
+	if (stat (path.c_str (), &st) != 0)
+	{
+		return FileStamp (-1, -1);
+	}
+	return FileStamp (static_cast<long long> (st.st_mtim.tv_sec) * 1000000000 +
+	                      st.st_mtim.tv_nsec,
+	                  static_cast<long long> (st.st_size));
+}
+
+void
+reload (const std::string &name)
+{
+	Seiscomp::Config::Config config;
+	if (!Seiscomp::Environment::Instance ()->initConfig (&config, name))
+	{
+		SEISCOMP_WARNING ("K_Class: failed to reread the configuration of %s, "
+		                  "keeping the current coefficients", name.c_str ());
+		return;
+	}
+
+	SEISCOMP_INFO ("K_Class: configuration of %s changed, reloading", name.c_str ());
+	Listeners &l = listeners ();
+	std::lock_guard<std::mutex> lock (l.mutex);
+	for (auto &listener : l.listeners)
+	{
+		listener.second (config);
+	}
+}
+
+class Poller
+{
+  public:
+	~Poller ()
+	{
+		stop ();
+	}
+
+	void
+	start (double interval, const std::string &name)
+	{
+		stop ();
+		if (interval <= 0)
+		{
+			return;
+		}
+
+		Seiscomp::Environment *env = Seiscomp::Environment::Instance ();
+		std::vector<std::string> files;
+		for (int stage = Seiscomp::Environment::CS_FIRST;
+		     stage <= Seiscomp::Environment::CS_LAST; ++stage)
+		{
+			files.push_back (env->configFileLocation (name, stage));
+		}
+
+		_stop = false;
+		_thread = std::thread ([this, interval, name, files] {
+			std::vector<FileStamp> stamps;
+			for (const std::string &file : files)
+			{
+				stamps.push_back (stamp (file));
+			}
+
+			std::unique_lock<std::mutex> lock (_mutex);
+			while (!_wakeup.wait_for (lock, std::chrono::duration<double> (interval),
+			                          [this] { return _stop; }))
+			{
+				lock.unlock ();
+				bool changed = false;
+				for (size_t i = 0; i < files.size (); ++i)
+				{
+					FileStamp current = stamp (files[i]);
+					changed = changed || current != stamps[i];
+					stamps[i] = current;
+				}
+				if (changed)
+				{
+					reload (name);
+				}
+				lock.lock ();
+			}
+		});
+	}
+
+	void
+	stop ()
+	{
+		{
+			std::lock_guard<std::mutex> lock (_mutex);
+			_stop = true;
+		}
+		_wakeup.notify_all ();
+		if (_thread.joinable ())
+		{
+			_thread.join ();
+		}
+	}
+
+  private:
+	std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::thread _thread;
+	bool _stop{true};
+};
+
+} // namespace
+
+
+namespace
+{
+
+// Intervals requested by the owners and the poller running at the shortest
+struct Intervals
+{
+	std::mutex mutex;
+	std::map<const void *, double> requested;
+	double current = 0;
+	Poller poller;
+};
+
+Intervals &
+intervals ()
+{
+	static Intervals instance;
+	return instance;
+}
+
+// Restarts the poller if the shortest requested interval changed. Every
+// processor requests its interval from setup, a running poller is kept so
+// that the file stamps are not taken again.
+void
+update (Intervals &i)
+{
+	double shortest = 0;
+	for (const auto &request : i.requested)
+	{
+		if (shortest == 0 || request.second < shortest)
+		{
+			shortest = request.second;
+		}
+	}
+	if (shortest == i.current)
+	{
+		return;
+	}
+
+	i.current = shortest;
+
+	// Offline tools run without an application and configuration files
+	Seiscomp::Client::Application *app = Seiscomp::Client::Application::Instance ();
+	if (!app)
+	{
+		return;
+	}
+
+	i.poller.start (shortest, app->name ());
+}
+
+} // namespace
+
+
+void
+ConfigReloader::Start (const void *owner, double interval)
+{
+	Intervals &i = intervals ();
+	std::lock_guard<std::mutex> lock (i.mutex);
+	if (interval > 0)
+	{
+		i.requested[owner] = interval;
+	}
+	else
+	{
+		i.requested.erase (owner);
+	}
+	update (i);
+}
+
+
+double
+ConfigReloader::Interval ()
+{
+	Intervals &i = intervals ();
+	std::lock_guard<std::mutex> lock (i.mutex);
+	return i.current;
+}
+
+
+void
+ConfigReloader::Add (const void *owner, Listener listener)
+{
+	Listeners &l = listeners ();
+	std::lock_guard<std::mutex> lock (l.mutex);
+	l.listeners[owner] = std::move (listener);
+}
+
+
+void
+ConfigReloader::Remove (const void *owner)
+{
+	{
+		Listeners &l = listeners ();
+		std::lock_guard<std::mutex> lock (l.mutex);
+		l.listeners.erase (owner);
+	}
+
+	// A poller stopped by this may be waiting for the listeners
+	Intervals &i = intervals ();
+	std::lock_guard<std::mutex> lock (i.mutex);
+	i.requested.erase (owner);
+	update (i);
+}
+
+} // namespace KClass
@@ -0,0 +1,43 @@
+// Reloading of the configuration on file changes
+
+#ifndef __K_Class_RELOAD_H__
+#define __K_Class_RELOAD_H__
+
+
+#include <seiscomp/config/config.h>
+
+#include <functional>
+
+
+namespace KClass
+{
+
+// Polls the configuration files of the running application and rereads the
+// whole configuration when one of them changed. Listeners are called from
+// the polling thread, so the reload costs nothing on the processing threads.
+class ConfigReloader
+{
+  public:
+	typedef std::function<void (const Seiscomp::Config::Config &)> Listener;
+
+	// Sets the polling interval in seconds requested by owner, 0 withdraws
+	// its request. The files are polled at the shortest requested
+	// interval, polling is restarted only if it changes and stops once no
+	// owner requests one.
+	static void Start (const void *owner, double interval);
+
+	// Shortest interval requested by an owner, 0 if none
+	static double Interval ();
+
+	// Registers the listener of owner, replacing a previous one
+	static void Add (const void *owner, Listener listener);
+
+	// Unregisters the listener and withdraws the interval of owner. Waits
+	// for a running call to finish, so the owner can be destroyed
+	// afterwards.
+	static void Remove (const void *owner);
+};
+
+} // namespace KClass
+
+#endif
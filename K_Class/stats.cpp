@@ -0,0 +1,201 @@
+#include "stats.h"
+
+#ifdef K_CLASS_STATISTICS
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace KClass
+{
+
+namespace Statistics
+{
+
+namespace
+{
+
+const char *CounterNames[CounterCount] = {
+	"feed N", "feed E", "feed Z", "rejected records", "reprocesses",
+	"component reprocesses", "reused results", "reused peaks", "amplitude computations",
+	"samples scanned"};
+
+const char *TimerNames[TimerCount] = {"travel-time compute", "trigger to emit"};
+
+// Blocks of all threads, kept after the threads exit so that the totals
+// stay complete
+struct Registry
+{
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ThreadBlock>> blocks;
+};
+
+Registry &
+registry ()
+{
+	static Registry *instance = new Registry;
+	return *instance;
+}
+
+class Reporter
+{
+  public:
+	~Reporter ()
+	{
+		stop ();
+	}
+
+	void
+	start (double interval, std::function<void (const std::string &)> report)
+	{
+		stop ();
+		if (interval <= 0 || !report)
+		{
+			return;
+		}
+
+		_stop = false;
+		_thread = std::thread ([this, interval, report] {
+			std::unique_lock<std::mutex> lock (_mutex);
+			while (!_wakeup.wait_for (lock, std::chrono::duration<double> (interval),
+			                          [this] { return _stop; }))
+			{
+				lock.unlock ();
+				report (Summary ());
+				lock.lock ();
+			}
+		});
+	}
+
+	void
+	stop ()
+	{
+		{
+			std::lock_guard<std::mutex> lock (_mutex);
+			_stop = true;
+		}
+		_wakeup.notify_all ();
+		if (_thread.joinable ())
+		{
+			_thread.join ();
+		}
+	}
+
+  private:
+	std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::thread _thread;
+	bool _stop{true};
+};
+
+} // namespace
+
+
+ThreadBlock::ThreadBlock ()
+{
+	for (auto &c : counters)
+		c.store (0, std::memory_order_relaxed);
+	for (int i = 0; i < TimerCount; ++i)
+	{
+		timerCount[i].store (0, std::memory_order_relaxed);
+		timerTotal[i].store (0, std::memory_order_relaxed);
+		timerMax[i].store (0, std::memory_order_relaxed);
+	}
+}
+
+
+ThreadBlock &
+Local ()
+{
+	thread_local ThreadBlock *block = nullptr;
+	if (!block)
+	{
+		Registry &reg = registry ();
+		std::lock_guard<std::mutex> lock (reg.mutex);
+		reg.blocks.emplace_back (new ThreadBlock);
+		block = reg.blocks.back ().get ();
+	}
+	return *block;
+}
+
+
+std::string
+Summary ()
+{
+	uint64_t counters[CounterCount] = {};
+	uint64_t count[TimerCount] = {}, total[TimerCount] = {}, max[TimerCount] = {};
+
+	{
+		Registry &reg = registry ();
+		std::lock_guard<std::mutex> lock (reg.mutex);
+		for (const auto &block : reg.blocks)
+		{
+			for (int i = 0; i < CounterCount; ++i)
+			{
+				counters[i] += block->counters[i].load (std::memory_order_relaxed);
+			}
+			for (int i = 0; i < TimerCount; ++i)
+			{
+				count[i] += block->timerCount[i].load (std::memory_order_relaxed);
+				total[i] += block->timerTotal[i].load (std::memory_order_relaxed);
+				max[i] = std::max (max[i], block->timerMax[i].load (std::memory_order_relaxed));
+			}
+		}
+	}
+
+	std::string text;
+	char buf[128];
+	for (int i = 0; i < CounterCount; ++i)
+	{
+		snprintf (buf, sizeof (buf), "%s%s %llu", text.empty () ? "" : ", ",
+		          CounterNames[i], (unsigned long long)counters[i]);
+		text += buf;
+	}
+
+	if (counters[AmplitudeComputations])
+	{
+		snprintf (buf, sizeof (buf), ", samples per computation %.1f",
+		          double (counters[SamplesScanned]) / counters[AmplitudeComputations]);
+		text += buf;
+	}
+
+	for (int i = 0; i < TimerCount; ++i)
+	{
+		snprintf (buf, sizeof (buf), ", %s %llu x mean %.3f ms max %.3f ms", TimerNames[i],
+		          (unsigned long long)count[i],
+		          count[i] ? total[i] * 1E-6 / count[i] : 0.0, max[i] * 1E-6);
+		text += buf;
+	}
+
+	return text;
+}
+
+
+void
+Start (double interval, std::function<void (const std::string &)> report)
+{
+	static Reporter reporter;
+	static std::mutex mutex;
+	static double current = 0;
+
+	// Every processor calls this from setup, keep a running reporter so
+	// that the period is not restarted
+	std::lock_guard<std::mutex> lock (mutex);
+	if (interval == current)
+	{
+		return;
+	}
+	current = interval;
+	reporter.start (interval, report);
+}
+
+} // namespace Statistics
+
+} // namespace KClass
+
+#endif
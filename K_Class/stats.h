@@ -0,0 +1,133 @@
+// Optional hot-path statistics of the K_Class processors
+
+#ifndef __K_Class_STATS_H__
+#define __K_Class_STATS_H__
+
+
+// Compiled in with -DK_CLASS_STATISTICS. Otherwise all KCLASS_STAT_*
+// macros expand to nothing and this header declares no code.
+#ifdef K_CLASS_STATISTICS
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+
+namespace KClass
+{
+
+namespace Statistics
+{
+
+enum Counter
+{
+	FeedN,
+	FeedE,
+	FeedZ,
+	RejectedRecords,
+	Reprocesses,
+	ComponentReprocesses,
+	ReusedResults,
+	ReusedPeaks,
+	AmplitudeComputations,
+	SamplesScanned,
+	CounterCount
+};
+
+enum Timer
+{
+	TravelTimeCompute,
+	TriggerToEmit,
+	TimerCount
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// Counters of the calling thread. Only the owning thread writes them, the
+// summary reads them with relaxed loads.
+struct ThreadBlock
+{
+	std::atomic<uint64_t> counters[CounterCount];
+	std::atomic<uint64_t> timerCount[TimerCount];
+	std::atomic<uint64_t> timerTotal[TimerCount]; // ns
+	std::atomic<uint64_t> timerMax[TimerCount];   // ns
+
+	ThreadBlock ();
+};
+
+ThreadBlock &Local ();
+
+inline void
+add (Counter counter, uint64_t n = 1)
+{
+	std::atomic<uint64_t> &c = Local ().counters[counter];
+	c.store (c.load (std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void
+record (Timer timer, uint64_t ns)
+{
+	ThreadBlock &block = Local ();
+	std::atomic<uint64_t> &count = block.timerCount[timer];
+	std::atomic<uint64_t> &total = block.timerTotal[timer];
+	std::atomic<uint64_t> &max = block.timerMax[timer];
+	count.store (count.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	total.store (total.load (std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+	if (ns > max.load (std::memory_order_relaxed))
+	{
+		max.store (ns, std::memory_order_relaxed);
+	}
+}
+
+inline void
+record (Timer timer, Clock::time_point start)
+{
+	record (timer, static_cast<uint64_t> (
+		std::chrono::duration_cast<std::chrono::nanoseconds> (Clock::now () - start).count ()));
+}
+
+// Records the lifetime of the object
+class ScopedTimer
+{
+  public:
+	explicit ScopedTimer (Timer timer) : _timer (timer), _start (Clock::now ()) {}
+	~ScopedTimer () { record (_timer, _start); }
+
+  private:
+	Timer _timer;
+	Clock::time_point _start;
+};
+
+// Sum of all threads since the start as one line
+std::string Summary ();
+
+// Starts a background thread passing the summary to report every interval
+// seconds. A later call with another interval restarts it, an interval of 0
+// stops the reports.
+void Start (double interval, std::function<void (const std::string &)> report);
+
+} // namespace Statistics
+
+} // namespace KClass
+
+#define KCLASS_STAT_ADD(counter, n) \
+	KClass::Statistics::add (KClass::Statistics::counter, n)
+#define KCLASS_STAT_SCOPE(timer) \
+	KClass::Statistics::ScopedTimer kclassStatTimer##timer (KClass::Statistics::timer)
+#define KCLASS_STAT_MARK(var) \
+	var = KClass::Statistics::Clock::now ()
+#define KCLASS_STAT_SINCE(timer, var) \
+	KClass::Statistics::record (KClass::Statistics::timer, var)
+
+#else
+
+#define KCLASS_STAT_ADD(counter, n)
+#define KCLASS_STAT_SCOPE(timer)
+#define KCLASS_STAT_MARK(var)
+#define KCLASS_STAT_SINCE(timer, var)
+
+#endif
+
+#endif
@@ -0,0 +1,210 @@
+#include "taskpool.h"
+
+
+namespace KClass
+{
+
+namespace
+{
+
+// Pool and index of the worker running on this thread
+thread_local const TaskPool *currentPool = nullptr;
+thread_local unsigned currentWorker = 0;
+
+} // namespace
+
+
+TaskPool::TaskPool (unsigned threads)
+{
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		_workers.emplace_back (new Worker);
+	}
+
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		_workers[i]->thread = std::thread (&TaskPool::work, this, i);
+	}
+}
+
+
+TaskPool::~TaskPool ()
+{
+	{
+		std::lock_guard<std::mutex> lock (_sleepMutex);
+		_stop = true;
+	}
+	_wakeup.notify_all ();
+
+	for (auto &worker : _workers)
+	{
+		worker->thread.join ();
+	}
+}
+
+
+TaskPool &
+TaskPool::Shared ()
+{
+	static TaskPool pool (std::thread::hardware_concurrency ());
+	return pool;
+}
+
+
+void
+TaskPool::run (Group &group, std::function<void ()> task)
+{
+	++group._pending;
+
+	unsigned index = currentPool == this
+		? currentWorker
+		: _nextWorker++ % _workers.size ();
+
+	{
+		std::lock_guard<std::mutex> lock (_workers[index]->mutex);
+		_workers[index]->tasks.push_back (Task{std::move (task), &group});
+	}
+
+	{
+		std::lock_guard<std::mutex> lock (_sleepMutex);
+		++_queued;
+	}
+	_wakeup.notify_one ();
+}
+
+
+void
+TaskPool::wait (Group &group)
+{
+	while (group._pending > 0)
+	{
+		Task task;
+		if (next (task))
+		{
+			execute (task);
+			continue;
+		}
+
+		// Everything left is running on other threads
+		std::unique_lock<std::mutex> lock (group._mutex);
+		group._done.wait (lock, [&group] { return group._pending == 0; });
+	}
+
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock (group._mutex);
+		std::swap (error, group._error);
+	}
+	if (error)
+	{
+		std::rethrow_exception (error);
+	}
+}
+
+
+void
+TaskPool::work (unsigned index)
+{
+	currentPool = this;
+	currentWorker = index;
+
+	while (true)
+	{
+		Task task;
+		if (pop (index, task) || steal (index, task))
+		{
+			execute (task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock (_sleepMutex);
+		_wakeup.wait (lock, [this] { return _stop || _queued > 0; });
+		if (_stop && _queued == 0)
+		{
+			return;
+		}
+	}
+}
+
+
+bool
+TaskPool::pop (unsigned index, Task &task)
+{
+	Worker &worker = *_workers[index];
+	std::lock_guard<std::mutex> lock (worker.mutex);
+	if (worker.tasks.empty ())
+	{
+		return false;
+	}
+
+	task = std::move (worker.tasks.back ());
+	worker.tasks.pop_back ();
+	--_queued;
+	return true;
+}
+
+
+bool
+TaskPool::steal (unsigned thief, Task &task)
+{
+	for (size_t i = 1; i <= _workers.size (); ++i)
+	{
+		Worker &victim = *_workers[(thief + i) % _workers.size ()];
+		std::lock_guard<std::mutex> lock (victim.mutex);
+		if (victim.tasks.empty ())
+		{
+			continue;
+		}
+
+		task = std::move (victim.tasks.front ());
+		victim.tasks.pop_front ();
+		--_queued;
+		return true;
+	}
+
+	return false;
+}
+
+
+bool
+TaskPool::next (Task &task)
+{
+	if (currentPool == this && pop (currentWorker, task))
+	{
+		return true;
+	}
+
+	return steal (currentPool == this ? currentWorker : 0, task);
+}
+
+
+void
+TaskPool::execute (Task &task)
+{
+	Group &group = *task.group;
+	try
+	{
+		task.func ();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock (group._mutex);
+		if (!group._error)
+		{
+			group._error = std::current_exception ();
+		}
+	}
+
+	std::lock_guard<std::mutex> lock (group._mutex);
+	if (--group._pending == 0)
+	{
+		group._done.notify_all ();
+	}
+}
+
+} // namespace KClass
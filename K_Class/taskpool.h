@@ -0,0 +1,92 @@
+// Small work-stealing thread pool
+
+#ifndef __K_Class_TASKPOOL_H__
+#define __K_Class_TASKPOOL_H__
+
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace KClass
+{
+
+// Fixed set of workers with one task deque each. Workers take their newest
+// task first and steal the oldest tasks of the others when idle. Tasks
+// spawned from a worker go to its own deque. Waiting on a group executes
+// pending tasks instead of blocking, so groups can be nested.
+class TaskPool
+{
+  public:
+	// Set of tasks that can be waited for
+	class Group
+	{
+	  public:
+		Group () = default;
+		Group (const Group &) = delete;
+		Group &operator= (const Group &) = delete;
+
+	  private:
+		std::atomic<size_t> _pending{0};
+		std::mutex _mutex;
+		std::condition_variable _done;
+		std::exception_ptr _error;
+
+		friend class TaskPool;
+	};
+
+	explicit TaskPool (unsigned threads);
+	~TaskPool ();
+
+	TaskPool (const TaskPool &) = delete;
+	TaskPool &operator= (const TaskPool &) = delete;
+
+	// Pool with one worker per hardware thread, created on first use
+	static TaskPool &Shared ();
+
+	unsigned size () const { return static_cast<unsigned> (_workers.size ()); }
+
+	void run (Group &group, std::function<void ()> task);
+
+	// Returns when all tasks of the group are done. The first exception
+	// thrown by one of them is rethrown.
+	void wait (Group &group);
+
+  private:
+	struct Task
+	{
+		std::function<void ()> func;
+		Group *group;
+	};
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::thread thread;
+	};
+
+	void work (unsigned index);
+	bool pop (unsigned index, Task &task);
+	bool steal (unsigned thief, Task &task);
+	bool next (Task &task);
+	void execute (Task &task);
+
+	std::vector<std::unique_ptr<Worker>> _workers;
+	std::atomic<unsigned> _nextWorker{0};
+	std::atomic<size_t> _queued{0};
+	std::mutex _sleepMutex;
+	std::condition_variable _wakeup;
+	bool _stop{false};
+};
+
+} // namespace KClass
+
+#endif
@@ -0,0 +1,186 @@
+#include "ttcache.h"
+
+#include <cmath>
+#include <iterator>
+
+
+namespace KClass
+{
+
+namespace
+{
+
+int32_t
+quantize (double value, double step)
+{
+	return static_cast<int32_t> (std::lround (value / step));
+}
+
+} // namespace
+
+
+TravelTimeCache &
+TravelTimeCache::Instance ()
+{
+	static TravelTimeCache instance;
+	return instance;
+}
+
+
+uint32_t
+TravelTimeCache::table (const std::string &interface, const std::string &model)
+{
+	// Intern the table name, there are only a handful of them per process
+	std::string table = interface + '/' + model;
+	std::lock_guard<std::mutex> lock (_mutex);
+	size_t i = 0;
+	for (; i < _tables.size (); ++i)
+	{
+		if (_tables[i] == table)
+		{
+			break;
+		}
+	}
+	if (i == _tables.size ())
+	{
+		_tables.push_back (table);
+	}
+
+	return static_cast<uint32_t> (i);
+}
+
+
+TravelTimeCache::Key
+TravelTimeCache::makeKey (uint32_t table, double depth, double distance, double elevation)
+{
+	Key key;
+	key.table = table;
+	key.depth = quantize (depth, DepthStep);
+	key.distance = quantize (distance, DistanceStep);
+	key.elevation = quantize (elevation, ElevationStep);
+
+	return key;
+}
+
+
+TravelTimeCache::Key
+TravelTimeCache::makeKey (
+	const std::string &interface, const std::string &model, double depth,
+	double distance, double elevation)
+{
+	return makeKey (table (interface, model), depth, distance, elevation);
+}
+
+
+bool
+TravelTimeCache::lookup (const Key &key, FirstArrivals &arrivals)
+{
+	std::lock_guard<std::mutex> lock (_mutex);
+	auto it = _index.find (key);
+	if (it == _index.end ())
+	{
+		++_misses;
+		return false;
+	}
+
+	// Move to the front of the LRU list
+	_entries.splice (_entries.begin (), _entries, it->second);
+	arrivals = it->second->second;
+	++_hits;
+	return true;
+}
+
+
+void
+TravelTimeCache::insert (const Key &key, const FirstArrivals &arrivals)
+{
+	std::lock_guard<std::mutex> lock (_mutex);
+	if (_capacity == 0)
+	{
+		return;
+	}
+
+	auto it = _index.find (key);
+	if (it != _index.end ())
+	{
+		it->second->second = arrivals;
+		_entries.splice (_entries.begin (), _entries, it->second);
+		return;
+	}
+
+	if (_entries.size () >= _capacity)
+	{
+		// Reuse the list and index nodes of the least recently used entry
+		trim ();
+		auto node = _index.extract (_entries.back ().first);
+		_entries.splice (_entries.begin (), _entries, std::prev (_entries.end ()));
+		_entries.front () = Entry (key, arrivals);
+		node.key () = key;
+		node.mapped () = _entries.begin ();
+		_index.insert (std::move (node));
+		return;
+	}
+
+	_entries.emplace_front (key, arrivals);
+	_index[key] = _entries.begin ();
+}
+
+
+void
+TravelTimeCache::setCapacity (size_t capacity)
+{
+	std::lock_guard<std::mutex> lock (_mutex);
+	_capacity = capacity;
+	trim ();
+}
+
+
+size_t
+TravelTimeCache::capacity () const
+{
+	std::lock_guard<std::mutex> lock (_mutex);
+	return _capacity;
+}
+
+
+size_t
+TravelTimeCache::size () const
+{
+	std::lock_guard<std::mutex> lock (_mutex);
+	return _entries.size ();
+}
+
+
+void
+TravelTimeCache::clear ()
+{
+	std::lock_guard<std::mutex> lock (_mutex);
+	_entries.clear ();
+	_index.clear ();
+	_hits = 0;
+	_misses = 0;
+}
+
+
+size_t
+TravelTimeCache::KeyHash::operator() (const Key &key) const
+{
+	uint64_t h = key.table;
+	h = h * 0x9E3779B97F4A7C15ULL + static_cast<uint32_t> (key.depth);
+	h = h * 0x9E3779B97F4A7C15ULL + static_cast<uint32_t> (key.distance);
+	h = h * 0x9E3779B97F4A7C15ULL + static_cast<uint32_t> (key.elevation);
+	return static_cast<size_t> (h ^ (h >> 32));
+}
+
+
+void
+TravelTimeCache::trim ()
+{
+	while (_entries.size () > _capacity)
+	{
+		_index.erase (_entries.back ().first);
+		_entries.pop_back ();
+	}
+}
+
+} // namespace KClass
@@ -0,0 +1,112 @@
+// Process-wide cache of first P and S travel times
+
+#ifndef __K_Class_TTCACHE_H__
+#define __K_Class_TTCACHE_H__
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace KClass
+{
+
+// Earliest P-type and S-type travel times in seconds relative to the origin
+// time
+struct FirstArrivals
+{
+	bool haveP = false;
+	bool haveS = false;
+	double p = 0.0;
+	double s = 0.0;
+};
+
+// Shared, thread-safe LRU cache of first arrivals. Travel times of the 1-D
+// tables only depend on the source depth, the epicentral distance and the
+// receiver elevation, so these are quantized into the key together with the
+// table (interface and model) that produced the value.
+class TravelTimeCache
+{
+  public:
+	// Quantization steps of the key
+	static constexpr double DepthStep = 0.05;       // km
+	static constexpr double DistanceStep = 0.0005;  // degrees (~55 m)
+	static constexpr double ElevationStep = 10.0;   // m
+
+	static constexpr size_t DefaultCapacity = 100000;
+
+	struct Key
+	{
+		uint32_t table;
+		int32_t depth;
+		int32_t distance;
+		int32_t elevation;
+
+		bool
+		operator== (const Key &other) const
+		{
+			return table == other.table && depth == other.depth &&
+			       distance == other.distance && elevation == other.elevation;
+		}
+	};
+
+	static TravelTimeCache &Instance ();
+
+	// Identifier of a table (interface and model) in the keys
+	uint32_t table (const std::string &interface, const std::string &model);
+
+	// Key of a table identifier, allocation and lock free
+	static Key makeKey (uint32_t table, double depth, double distance, double elevation);
+
+	Key
+	makeKey (
+		const std::string &interface, const std::string &model,
+		double depth, double distance, double elevation);
+
+	bool lookup (const Key &key, FirstArrivals &arrivals);
+	// Once the cache is full the least recently used entry is recycled,
+	// so that inserting does not allocate
+	void insert (const Key &key, const FirstArrivals &arrivals);
+
+	// A capacity of 0 disables the cache
+	void setCapacity (size_t capacity);
+	size_t capacity () const;
+
+	size_t size () const;
+	uint64_t hits () const { return _hits; }
+	uint64_t misses () const { return _misses; }
+
+	void clear ();
+
+  private:
+	struct KeyHash
+	{
+		size_t operator() (const Key &key) const;
+	};
+
+	typedef std::pair<Key, FirstArrivals> Entry;
+	typedef std::list<Entry> EntryList;
+
+	TravelTimeCache () = default;
+
+	void trim ();
+
+	mutable std::mutex _mutex;
+	size_t _capacity{DefaultCapacity};
+	EntryList _entries; // most recently used first
+	std::unordered_map<Key, EntryList::iterator, KeyHash> _index;
+	std::vector<std::string> _tables;
+
+	std::atomic<uint64_t> _hits{0};
+	std::atomic<uint64_t> _misses{0};
+};
+
+} // namespace KClass
+
+#endif
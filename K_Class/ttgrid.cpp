@@ -0,0 +1,410 @@
+#include "ttgrid.h"
+#include "magnitude.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace KClass
+{
+
+namespace
+{
+
+// Version 2: the error estimate includes elevated receivers
+const char GridMagic[8] = {'K', 'C', 'T', 'T', 'G', 'R', 'D', '2'};
+
+// On-disk header, followed by the P and then the S times of all nodes
+struct GridFileHeader
+{
+	char magic[8];
+	char table[112];
+	uint64_t nDistance;
+	uint64_t nDepth;
+	double maxDistance;
+	double maxDepth;
+	double distanceStep;
+	double depthStep;
+	double maxErrorP;
+	double maxErrorS;
+};
+
+size_t
+nodeCount (double range, double step)
+{
+	return static_cast<size_t> (std::ceil (range / step - 1E-9)) + 1;
+}
+
+// Parameters of a grid with at least one cell
+bool
+valid (const TravelTimeGrid::Parameters &params)
+{
+	return params.distanceStep > 0 && params.depthStep > 0 &&
+	       params.maxDistance > 0 && params.maxDepth >= 0;
+}
+
+// Nodes of the grid in both directions, at least two depths to interpolate
+// between
+void
+gridSize (const TravelTimeGrid::Parameters &params, size_t &nDistance, size_t &nDepth)
+{
+	nDistance = nodeCount (params.maxDistance, params.distanceStep);
+	nDepth = std::max<size_t> (nodeCount (params.maxDepth, params.depthStep), 2);
+}
+
+// Mean duration (s) of an evaluation across the grid. The first one is not
+// timed, it may load the travel-time tables.
+double
+evaluationTime (const TravelTimeGrid::Parameters &params, const TravelTimeGrid::Evaluator &eval)
+{
+	const int samples = 8;
+	FirstArrivals arrivals;
+	eval (0.0, 0.0, 0.0, arrivals);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	for (int i = 1; i <= samples; ++i)
+	{
+		eval (params.maxDistance * i / samples, params.maxDepth * i / samples, 0.0, arrivals);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now () - start;
+	return elapsed.count () / samples;
+}
+
+std::string
+sharedKey (const TravelTimeGrid::Parameters &params)
+{
+	char buf[128];
+	snprintf (buf, sizeof (buf), "/%g/%g/%g/%g", params.maxDistance,
+	          params.maxDepth, params.distanceStep, params.depthStep);
+	return params.table + buf;
+}
+
+} // namespace
+
+
+bool
+TravelTimeGrid::Parameters::operator== (const Parameters &other) const
+{
+	return table == other.table && maxDistance == other.maxDistance &&
+	       maxDepth == other.maxDepth && distanceStep == other.distanceStep &&
+	       depthStep == other.depthStep;
+}
+
+
+TravelTimeGrid::~TravelTimeGrid ()
+{
+	if (_map)
+	{
+		munmap (_map, _mapSize);
+	}
+}
+
+
+std::shared_ptr<const TravelTimeGrid>
+TravelTimeGrid::Shared (
+	const Parameters &params, const std::string &file, const Evaluator &eval,
+	const BuildNotifier &notify)
+{
+	static std::mutex mutex;
+	static std::map<std::string, std::shared_ptr<const TravelTimeGrid>> grids;
+
+	std::lock_guard<std::mutex> lock (mutex);
+	std::string key = sharedKey (params);
+	auto it = grids.find (key);
+	if (it != grids.end ())
+	{
+		return it->second;
+	}
+
+	std::shared_ptr<TravelTimeGrid> grid;
+	if (!file.empty ())
+	{
+		grid = Load (params, file);
+	}
+
+	if (!grid)
+	{
+		if (notify && valid (params))
+		{
+			size_t evaluations = Evaluations (params);
+			notify (evaluations, evaluations * evaluationTime (params, eval));
+		}
+		grid = Build (params, eval);
+		if (!grid)
+		{
+			return nullptr;
+		}
+
+		if (!file.empty ())
+		{
+			grid->save (file);
+		}
+	}
+
+	grids[key] = grid;
+	return grid;
+}
+
+
+size_t
+TravelTimeGrid::Evaluations (const Parameters &params)
+{
+	size_t nDistance, nDepth;
+	gridSize (params, nDistance, nDepth);
+
+	// estimateError checks every other cell at two elevations
+	return nDistance * nDepth + 2 * (nDistance / 2) * (nDepth / 2);
+}
+
+
+std::shared_ptr<TravelTimeGrid>
+TravelTimeGrid::Build (const Parameters &params, const Evaluator &eval)
+{
+	if (!valid (params))
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<TravelTimeGrid> grid (new TravelTimeGrid);
+	grid->_params = params;
+	gridSize (params, grid->_nDistance, grid->_nDepth);
+
+	size_t nodes = grid->_nDistance * grid->_nDepth;
+	grid->_storage.assign (2 * nodes, std::numeric_limits<double>::quiet_NaN ());
+	double *p = grid->_storage.data ();
+	double *s = p + nodes;
+
+	for (size_t iz = 0; iz < grid->_nDepth; ++iz)
+	{
+		for (size_t ix = 0; ix < grid->_nDistance; ++ix)
+		{
+			FirstArrivals arrivals;
+			if (!eval (ix * params.distanceStep, iz * params.depthStep, 0.0, arrivals))
+			{
+				continue;
+			}
+
+			size_t i = iz * grid->_nDistance + ix;
+			if (arrivals.haveP)
+			{
+				p[i] = arrivals.p;
+			}
+			if (arrivals.haveS)
+			{
+				s[i] = arrivals.s;
+			}
+		}
+	}
+
+	grid->_p = p;
+	grid->_s = s;
+	grid->estimateError (eval);
+
+	return grid;
+}
+
+
+std::shared_ptr<TravelTimeGrid>
+TravelTimeGrid::Load (const Parameters &params, const std::string &file)
+{
+	int fd = open (file.c_str (), O_RDONLY);
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat (fd, &st) != 0 || st.st_size < (off_t)sizeof (GridFileHeader))
+	{
+		close (fd);
+		return nullptr;
+	}
+
+	size_t size = static_cast<size_t> (st.st_size);
+	void *map = mmap (nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<TravelTimeGrid> grid (new TravelTimeGrid);
+	grid->_map = map;
+	grid->_mapSize = size;
+
+	const GridFileHeader *header = static_cast<const GridFileHeader *> (map);
+	Parameters stored;
+	stored.table.assign (header->table, strnlen (header->table, sizeof (header->table)));
+	stored.maxDistance = header->maxDistance;
+	stored.maxDepth = header->maxDepth;
+	stored.distanceStep = header->distanceStep;
+	stored.depthStep = header->depthStep;
+
+	size_t nodes = header->nDistance * header->nDepth;
+	if (memcmp (header->magic, GridMagic, sizeof (GridMagic)) != 0 ||
+	    !(stored == params) || header->nDistance < 2 || header->nDepth < 2 ||
+	    size != sizeof (GridFileHeader) + 2 * nodes * sizeof (double))
+	{
+		// Stale or foreign file, the caller rebuilds it
+		return nullptr;
+	}
+
+	grid->_params = stored;
+	grid->_nDistance = header->nDistance;
+	grid->_nDepth = header->nDepth;
+	grid->_p = reinterpret_cast<const double *> (header + 1);
+	grid->_s = grid->_p + nodes;
+	grid->_maxErrorP = header->maxErrorP;
+	grid->_maxErrorS = header->maxErrorS;
+
+	return grid;
+}
+
+
+bool
+TravelTimeGrid::save (const std::string &file) const
+{
+	GridFileHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, GridMagic, sizeof (GridMagic));
+	strncpy (header.table, _params.table.c_str (), sizeof (header.table) - 1);
+	header.nDistance = _nDistance;
+	header.nDepth = _nDepth;
+	header.maxDistance = _params.maxDistance;
+	header.maxDepth = _params.maxDepth;
+	header.distanceStep = _params.distanceStep;
+	header.depthStep = _params.depthStep;
+	header.maxErrorP = _maxErrorP;
+	header.maxErrorS = _maxErrorS;
+
+	// Write to a temporary file and rename it so that concurrently starting
+	// modules never map a partially written grid
+	std::string tmp = file + ".tmp." + std::to_string (getpid ());
+	FILE *fp = fopen (tmp.c_str (), "wb");
+	if (!fp)
+	{
+		return false;
+	}
+
+	size_t nodes = _nDistance * _nDepth;
+	bool ok = fwrite (&header, sizeof (header), 1, fp) == 1 &&
+	          fwrite (_p, sizeof (double), nodes, fp) == nodes &&
+	          fwrite (_s, sizeof (double), nodes, fp) == nodes;
+	ok = (fclose (fp) == 0) && ok;
+
+	if (!ok || rename (tmp.c_str (), file.c_str ()) != 0)
+	{
+		unlink (tmp.c_str ());
+		return false;
+	}
+
+	return true;
+}
+
+
+bool
+TravelTimeGrid::interpolate (
+	double distance, double depth, double elevation,
+	FirstArrivals &arrivals) const
+{
+	arrivals.haveP = arrivals.haveS = false;
+
+	double x = distance / _params.distanceStep;
+	double z = depth / _params.depthStep;
+	if (!(x >= 0) || !(z >= 0) || x > _nDistance - 1 || z > _nDepth - 1)
+	{
+		return false;
+	}
+
+	size_t ix = std::min (static_cast<size_t> (x), _nDistance - 2);
+	size_t iz = std::min (static_cast<size_t> (z), _nDepth - 2);
+	double fx = x - ix;
+	double fz = z - iz;
+
+	size_t i00 = iz * _nDistance + ix;
+	size_t i10 = i00 + _nDistance;
+
+	double w00 = (1 - fx) * (1 - fz);
+	double w01 = fx * (1 - fz);
+	double w10 = (1 - fx) * fz;
+	double w11 = fx * fz;
+
+	// NaN nodes (missing phase) propagate into the sum
+	double p = w00 * _p[i00] + w01 * _p[i00 + 1] + w10 * _p[i10] + w11 * _p[i10 + 1];
+	double s = w00 * _s[i00] + w01 * _s[i00 + 1] + w10 * _s[i10] + w11 * _s[i10 + 1];
+
+	if (elevation != 0)
+	{
+		// Ray parameters (s/km) from the distance slope of the cell
+		double km = _params.distanceStep * KmPerDegree;
+		double rayP = ((1 - fz) * (_p[i00 + 1] - _p[i00]) + fz * (_p[i10 + 1] - _p[i10])) / km;
+		double rayS = ((1 - fz) * (_s[i00 + 1] - _s[i00]) + fz * (_s[i10 + 1] - _s[i10])) / km;
+		p += elevation * std::sqrt (std::max (0.0, 1 / (SurfaceVp * SurfaceVp) - rayP * rayP));
+		s += elevation * std::sqrt (std::max (0.0, 1 / (SurfaceVs * SurfaceVs) - rayS * rayS));
+	}
+
+	if (!std::isnan (p))
+	{
+		arrivals.p = p;
+		arrivals.haveP = true;
+	}
+
+	if (!std::isnan (s))
+	{
+		arrivals.s = s;
+		arrivals.haveS = true;
+	}
+
+	return true;
+}
+
+
+void
+TravelTimeGrid::estimateError (const Evaluator &eval)
+{
+	// Check every other cell centre in both directions, the worst case is
+	// where the interpolation is furthest away from the nodes. Receivers at
+	// sea level bound the interpolation error, the highest receivers add
+	// that of the elevation correction.
+	_maxErrorP = _maxErrorS = 0;
+	for (size_t iz = 0; iz + 1 < _nDepth; iz += 2)
+	{
+		for (size_t ix = 0; ix + 1 < _nDistance; ix += 2)
+		{
+			double distance = (ix + 0.5) * _params.distanceStep;
+			double depth = (iz + 0.5) * _params.depthStep;
+
+			for (double elevation : {0.0, MaxCheckedElevation})
+			{
+				FirstArrivals exact, approx;
+				if (!eval (distance, depth, elevation, exact) ||
+				    !interpolate (distance, depth, elevation, approx))
+				{
+					continue;
+				}
+
+				if (exact.haveP && approx.haveP)
+				{
+					_maxErrorP = std::max (_maxErrorP, std::abs (approx.p - exact.p));
+				}
+				if (exact.haveS && approx.haveS)
+				{
+					_maxErrorS = std::max (_maxErrorS, std::abs (approx.s - exact.s));
+				}
+			}
+		}
+	}
+}
+
+} // namespace KClass
@@ -0,0 +1,116 @@
+// Precomputed grid of first P and S travel times
+
+#ifndef __K_Class_TTGRID_H__
+#define __K_Class_TTGRID_H__
+
+
+#include "ttcache.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace KClass
+{
+
+// Regular distance/depth grid of the earliest P and S times of one travel-time
+// table for receivers at sea level. Times between the nodes are bilinearly
+// interpolated and corrected for the receiver elevation. The grid is either
+// built from an exact evaluator or mapped from a file written by an earlier
+// build.
+class TravelTimeGrid
+{
+  public:
+	// Velocities (km/s) above sea level of the elevation correction, those
+	// of the travel-time interfaces
+	static constexpr double SurfaceVp = 5.8;
+	static constexpr double SurfaceVs = 3.46;
+
+	// Highest receiver elevation (km) included in the error estimate
+	static constexpr double MaxCheckedElevation = 3.0;
+
+	struct Parameters
+	{
+		std::string table;      // interface/model the times come from
+		double maxDistance;     // degrees
+		double maxDepth;        // km
+		double distanceStep;    // degrees
+		double depthStep;       // km
+
+		bool operator== (const Parameters &other) const;
+	};
+
+	// Exact first arrivals at an epicentral distance (degrees) and a source
+	// depth (km) for a receiver elevation (km)
+	typedef std::function<bool (double distance, double depth, double elevation,
+	                            FirstArrivals &)>
+		Evaluator;
+
+	// Called before a grid is built with the number of evaluations and
+	// their expected duration (s), timed on a few of them
+	typedef std::function<void (size_t evaluations, double seconds)> BuildNotifier;
+
+	~TravelTimeGrid ();
+
+	// Returns the process-wide grid for the parameters. It is mapped from
+	// file if that holds a matching grid, otherwise it is built with eval
+	// and written to file (if not empty) for the next start.
+	static std::shared_ptr<const TravelTimeGrid>
+	Shared (
+		const Parameters &params, const std::string &file,
+		const Evaluator &eval, const BuildNotifier &notify = BuildNotifier ());
+
+	// Number of evaluator calls of Build, the nodes and the error estimate
+	static size_t Evaluations (const Parameters &params);
+
+	static std::shared_ptr<TravelTimeGrid>
+	Build (const Parameters &params, const Evaluator &eval);
+
+	static std::shared_ptr<TravelTimeGrid>
+	Load (const Parameters &params, const std::string &file);
+
+	bool save (const std::string &file) const;
+
+	// Returns false if the point is outside of the grid. A phase is only
+	// reported if it exists at all four surrounding nodes. The sea level
+	// time is delayed by the vertical leg above sea level,
+	// elevation * sqrt(1/v^2 - p^2) with the ray parameter p taken from the
+	// slope of the grid.
+	bool
+	interpolate (
+		double distance, double depth, double elevation,
+		FirstArrivals &arrivals) const;
+
+	const Parameters &parameters () const { return _params; }
+
+	// Maximum absolute deviation (s) from the exact times observed at the
+	// cell centres while the grid was built, at sea level and at
+	// MaxCheckedElevation
+	double maxErrorP () const { return _maxErrorP; }
+	double maxErrorS () const { return _maxErrorS; }
+
+  private:
+	TravelTimeGrid () = default;
+	TravelTimeGrid (const TravelTimeGrid &) = delete;
+	TravelTimeGrid &operator= (const TravelTimeGrid &) = delete;
+
+	void estimateError (const Evaluator &eval);
+
+	Parameters _params;
+	size_t _nDistance{0};
+	size_t _nDepth{0};
+	const double *_p{nullptr};
+	const double *_s{nullptr};
+	double _maxErrorP{0};
+	double _maxErrorS{0};
+
+	std::vector<double> _storage;
+	void *_map{nullptr};
+	size_t _mapSize{0};
+};
+
+} // namespace KClass
+
+#endif
@@ -0,0 +1,324 @@
+#include "ttlayered.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+
+namespace KClass
+{
+
+namespace
+{
+
+// Bracketed Newton iterations of the ray parameter, far more than the
+// usual 5-10
+const int MaxIterations = 64;
+
+bool
+parseDouble (const std::string &text, double &value)
+{
+	const char *begin = text.c_str ();
+	char *end;
+	value = strtod (begin, &end);
+	if (end == begin)
+	{
+		return false;
+	}
+	while (*end == ' ' || *end == '\t')
+	{
+		++end;
+	}
+	return *end == '\0';
+}
+
+std::string
+trim (const std::string &text)
+{
+	size_t begin = text.find_first_not_of (" \t");
+	if (begin == std::string::npos)
+	{
+		return std::string ();
+	}
+	size_t end = text.find_last_not_of (" \t");
+	return text.substr (begin, end - begin + 1);
+}
+
+bool
+valid (const std::vector<LayeredModel::Layer> &layers)
+{
+	if (layers.empty () || layers.size () > LayeredModel::MaxLayers)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < layers.size (); ++i)
+	{
+		const LayeredModel::Layer &layer = layers[i];
+		if (!std::isfinite (layer.depth) || !std::isfinite (layer.vp) ||
+		    !(layer.vs > 0) || !(layer.vp > layer.vs))
+		{
+			return false;
+		}
+		if (i > 0 && !(layer.depth > layers[i - 1].depth))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Length of [a1, a2] inside [b1, b2]
+inline double
+overlap (double a1, double a2, double b1, double b2)
+{
+	return std::max (0.0, std::min (a2, b2) - std::max (a1, b1));
+}
+
+} // namespace
+
+
+const char *const LayeredModel::DefaultModel = "0:5.8:3.36, 20:6.5:3.75, 35:8.04:4.47";
+
+
+bool
+LayeredModel::Parse (const std::string &text, std::vector<Layer> &layers)
+{
+	layers.clear ();
+
+	std::stringstream ss (text);
+	std::string entry;
+	while (std::getline (ss, entry, ','))
+	{
+		entry = trim (entry);
+		if (entry.empty ())
+		{
+			continue;
+		}
+
+		std::vector<std::string> fields;
+		std::stringstream es (entry);
+		std::string field;
+		while (std::getline (es, field, ':'))
+		{
+			fields.push_back (trim (field));
+		}
+
+		Layer layer;
+		if (fields.size () != 3 || !parseDouble (fields[0], layer.depth) ||
+		    !parseDouble (fields[1], layer.vp) || !parseDouble (fields[2], layer.vs))
+		{
+			return false;
+		}
+
+		layers.push_back (layer);
+	}
+
+	return valid (layers);
+}
+
+
+bool
+LayeredModel::set (const std::vector<Layer> &layers)
+{
+	if (!valid (layers))
+	{
+		return false;
+	}
+
+	_layers = layers;
+	_velocities.resize (2 * layers.size ());
+	for (size_t i = 0; i < layers.size (); ++i)
+	{
+		_velocities[i] = layers[i].vp;
+		_velocities[layers.size () + i] = layers[i].vs;
+	}
+
+	return true;
+}
+
+
+bool
+LayeredModel::firstArrivals (
+	double distance, double depth, double elevation,
+	FirstArrivals &arrivals) const
+{
+	arrivals = FirstArrivals ();
+	if (_layers.empty () || !(distance >= 0) || !std::isfinite (distance) ||
+	    !std::isfinite (depth) || !std::isfinite (elevation))
+	{
+		return false;
+	}
+
+	double top = std::min (depth, -elevation);
+	double bottom = std::max (depth, -elevation);
+	arrivals.p = firstArrival (_velocities.data (), distance, top, bottom);
+	arrivals.s = firstArrival (_velocities.data () + _layers.size (), distance, top, bottom);
+	arrivals.haveP = arrivals.haveS = true;
+
+	return true;
+}
+
+
+void
+LayeredModel::firstArrivals (
+	size_t n, const double *distance, const double *elevation,
+	double depth, double *p, double *s) const
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		FirstArrivals arrivals;
+		if (firstArrivals (distance[i], depth, elevation[i], arrivals))
+		{
+			p[i] = arrivals.p;
+			s[i] = arrivals.s;
+		}
+		else
+		{
+			p[i] = s[i] = NAN;
+		}
+	}
+}
+
+
+double
+LayeredModel::firstArrival (
+	const double *velocity, double distance, double top, double bottom) const
+{
+	size_t n = _layers.size ();
+
+	// Path lengths of the direct wave through each layer, the top layer
+	// reaches up to the receiver and the last one down to the source
+	double thickness[MaxLayers];
+	double total = 0;
+	double vmax = 0;
+	size_t bottomLayer = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		double layerTop = i == 0 ? -HUGE_VAL : _layers[i].depth;
+		double layerBottom = i + 1 == n ? HUGE_VAL : _layers[i + 1].depth;
+		thickness[i] = overlap (top, bottom, layerTop, layerBottom);
+		total += thickness[i];
+		if (thickness[i] > 0)
+		{
+			vmax = std::max (vmax, velocity[i]);
+		}
+		if (bottom >= layerTop)
+		{
+			bottomLayer = i;
+		}
+	}
+
+	double best;
+	if (total <= 0)
+	{
+		// Source and receiver at the same depth
+		best = distance / velocity[bottomLayer];
+	}
+	else
+	{
+		// Ray parameter p of the direct wave from x(p) = distance, with
+		// x(p) = sum d * p * v / sqrt(1 - p^2 * v^2) increasing and convex
+		// on [0, 1 / vmax). Newton steps leaving the bracket bisect.
+		double p = 0;
+		if (distance > 0)
+		{
+			double lo = 0, hi = 1 / vmax;
+			p = hi * distance / std::sqrt (distance * distance + total * total);
+			for (int iter = 0; iter < MaxIterations; ++iter)
+			{
+				double x = 0, dx = 0;
+				for (size_t i = 0; i < n; ++i)
+				{
+					if (thickness[i] <= 0)
+					{
+						continue;
+					}
+					double pv = p * velocity[i];
+					double cos2 = 1 - pv * pv;
+					if (cos2 <= 0)
+					{
+						x = HUGE_VAL;
+						break;
+					}
+					double secant = 1 / std::sqrt (cos2);
+					x += thickness[i] * pv * secant;
+					dx += thickness[i] * velocity[i] * secant * secant * secant;
+				}
+
+				double f = x - distance;
+				if (std::fabs (f) <= 1E-9 * (1 + distance))
+				{
+					break;
+				}
+				if (f < 0)
+				{
+					lo = p;
+				}
+				else
+				{
+					hi = p;
+				}
+				double next = p - f / dx;
+				p = next > lo && next < hi ? next : 0.5 * (lo + hi);
+			}
+		}
+
+		// t = p * x + sum d * eta is stationary in p, so the residual of
+		// the iteration only enters to second order
+		best = p * distance;
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (thickness[i] > 0)
+			{
+				double v = velocity[i];
+				best += thickness[i] * std::sqrt (std::max (0.0, 1 / (v * v) - p * p));
+			}
+		}
+	}
+
+	// Head waves along the interfaces below source and receiver whose
+	// velocity exceeds all velocities above, beyond their critical distance
+	for (size_t k = 1; k < n; ++k)
+	{
+		double boundary = _layers[k].depth;
+		if (boundary < bottom)
+		{
+			continue;
+		}
+
+		double pk = 1 / velocity[k];
+		double delay = 0, critical = 0;
+		bool refracted = true;
+		for (size_t i = 0; i < k; ++i)
+		{
+			double layerTop = i == 0 ? -HUGE_VAL : _layers[i].depth;
+			double layerBottom = _layers[i + 1].depth;
+			double legs = overlap (top, boundary, layerTop, layerBottom) +
+			              overlap (bottom, boundary, layerTop, layerBottom);
+			if (legs <= 0)
+			{
+				continue;
+			}
+			if (velocity[i] >= velocity[k])
+			{
+				refracted = false;
+				break;
+			}
+			double eta = std::sqrt (1 / (velocity[i] * velocity[i]) - pk * pk);
+			delay += legs * eta;
+			critical += legs * pk / eta;
+		}
+
+		if (refracted && distance >= critical)
+		{
+			best = std::min (best, distance * pk + delay);
+		}
+	}
+
+	return best;
+}
+
+} // namespace KClass
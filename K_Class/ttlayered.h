@@ -0,0 +1,72 @@
+// First P and S travel times of a flat layered model
+
+#ifndef __K_Class_TTLAYERED_H__
+#define __K_Class_TTLAYERED_H__
+
+
+#include "ttcache.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+namespace KClass
+{
+
+// Flat model of constant velocity layers over a half-space. The earliest P
+// and S are the fastest of the direct wave and the head waves along the
+// interfaces below source and receiver, computed analytically with no
+// allocation. Meant for local distances (up to about 1000 km) where the
+// curvature of the earth is negligible.
+class LayeredModel
+{
+  public:
+	struct Layer
+	{
+		double depth; // top of the layer, km
+		double vp;    // km/s
+		double vs;    // km/s
+	};
+
+	static constexpr size_t MaxLayers = 32;
+
+	// IASP91 crust and upper mantle
+	static const char *const DefaultModel;
+
+	// Parses "depth:vp:vs, ..." with increasing depths, the last layer is
+	// the half-space
+	static bool Parse (const std::string &text, std::vector<Layer> &layers);
+
+	// Returns false and keeps the current layers if they are invalid
+	bool set (const std::vector<Layer> &layers);
+
+	const std::vector<Layer> &layers () const { return _layers; }
+
+	// First arrivals at an epicentral distance (km) from a source depth
+	// (km) for a receiver elevation (km). The top layer extends up to the
+	// receiver.
+	bool
+	firstArrivals (
+		double distance, double depth, double elevation,
+		FirstArrivals &arrivals) const;
+
+	// First arrivals of n receivers from one source, p and s receive the
+	// times
+	void
+	firstArrivals (
+		size_t n, const double *distance, const double *elevation,
+		double depth, double *p, double *s) const;
+
+  private:
+	// Earliest time over the given velocities (offset into _velocities)
+	double firstArrival (const double *velocity, double distance, double top, double bottom) const;
+
+	std::vector<Layer> _layers;
+	// P velocities followed by S velocities, one per layer
+	std::vector<double> _velocities;
+};
+
+} // namespace KClass
+
+#endif
@@ -0,0 +1,64 @@
+#include "ttpool.h"
+
+#include <atomic>
+#include <map>
+#include <utility>
+
+
+namespace KClass
+{
+
+namespace
+{
+
+typedef std::pair<std::string, std::string> PoolKey;
+
+std::atomic<size_t> tableCount{0};
+
+// Tables of one thread, released when the thread exits
+struct ThreadTables
+{
+	std::map<PoolKey, Seiscomp::TravelTimeTableInterfacePtr> tables;
+
+	~ThreadTables ()
+	{
+		tableCount -= tables.size ();
+	}
+};
+
+thread_local ThreadTables threadTables;
+
+} // namespace
+
+
+Seiscomp::TravelTimeTableInterfacePtr
+TravelTimeTablePool::Acquire (const std::string &interface, const std::string &model)
+{
+	PoolKey key (interface, model);
+	auto it = threadTables.tables.find (key);
+	if (it != threadTables.tables.end ())
+	{
+		return it->second;
+	}
+
+	Seiscomp::TravelTimeTableInterfacePtr ttt =
+		Seiscomp::TravelTimeTableInterface::Create (interface.c_str ());
+	if (!ttt || !ttt->setModel (model.c_str ()))
+	{
+		return nullptr;
+	}
+
+	// The thread keeps a reference so the table stays loaded until it exits
+	threadTables.tables[key] = ttt;
+	++tableCount;
+	return ttt;
+}
+
+
+size_t
+TravelTimeTablePool::Size ()
+{
+	return tableCount;
+}
+
+} // namespace KClass
@@ -0,0 +1,36 @@
+// Registry of shared travel-time table interfaces
+
+#ifndef __K_Class_TTPOOL_H__
+#define __K_Class_TTPOOL_H__
+
+
+#include <seiscomp/seismology/ttt.h>
+
+#include <string>
+
+
+namespace KClass
+{
+
+// Pool of ready to use travel-time tables keyed by (interface, model).
+// Loading a model is expensive and one amplitude processor is created per
+// station and origin, so instances borrow a table from the pool instead of
+// creating their own. The SeisComP interfaces do not guarantee re-entrancy,
+// hence each thread gets its own table: callers acquire the table on the
+// thread that evaluates it and must not hand it to another thread. The
+// tables of a thread are released when it exits.
+class TravelTimeTablePool
+{
+  public:
+	// Table of the calling thread. Returns nullptr if the interface does not
+	// exist or the model cannot be loaded.
+	static Seiscomp::TravelTimeTableInterfacePtr
+	Acquire (const std::string &interface, const std::string &model);
+
+	// Number of tables held by running threads
+	static size_t Size ();
+};
+
+} // namespace KClass
+
+#endif
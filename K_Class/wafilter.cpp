@@ -0,0 +1,100 @@
+#include "wafilter.h"
+
+#include <cmath>
+
+
+namespace KClass
+{
+
+bool
+WoodAndersonFilter::setLane (int lane, double fsamp, const WoodAndersonResponse &response)
+{
+	if (lane < 0 || lane >= Lanes || !(fsamp > 0) || !(response.period > 0) ||
+	    !(response.damping > 0))
+	{
+		return false;
+	}
+
+	double w0 = 2 * M_PI / response.period;
+	double k = 2 * fsamp;
+	double a0 = k * k + 2 * response.damping * w0 * k + w0 * w0;
+
+	// The numerator gain * k * (1 - z^-2) has no z^-1 term
+	_b0[lane] = response.gain * k / a0;
+	_b2[lane] = -_b0[lane];
+	_a1[lane] = (2 * w0 * w0 - 2 * k * k) / a0;
+	_a2[lane] = (k * k - 2 * response.damping * w0 * k + w0 * w0) / a0;
+	_fsamp[lane] = fsamp;
+	resetLane (lane);
+	return true;
+}
+
+
+void
+WoodAndersonFilter::resetLane (int lane)
+{
+	_z1[lane] = _z2[lane] = 0;
+}
+
+
+void
+WoodAndersonFilter::apply (int lane, size_t n, double *samples)
+{
+	double b0 = _b0[lane], b2 = _b2[lane], a1 = _a1[lane], a2 = _a2[lane];
+	double z1 = _z1[lane], z2 = _z2[lane];
+
+	// Transposed direct form II
+	for (size_t i = 0; i < n; ++i)
+	{
+		double x = samples[i];
+		double y = b0 * x + z1;
+		z1 = -a1 * y + z2;
+		z2 = b2 * x - a2 * y;
+		samples[i] = y;
+	}
+
+	_z1[lane] = z1;
+	_z2[lane] = z2;
+}
+
+
+void
+WoodAndersonFilter::apply (size_t n, double *samples0, double *samples1, double *samples2)
+{
+	// The recursion of one lane is latency bound. Running the three
+	// independent lanes in the same loop overlaps their dependency chains,
+	// each lane still goes through exactly the operations of the single
+	// lane loop.
+	double b00 = _b0[0], b20 = _b2[0], a10 = _a1[0], a20 = _a2[0];
+	double b01 = _b0[1], b21 = _b2[1], a11 = _a1[1], a21 = _a2[1];
+	double b02 = _b0[2], b22 = _b2[2], a12 = _a1[2], a22 = _a2[2];
+	double z10 = _z1[0], z20 = _z2[0];
+	double z11 = _z1[1], z21 = _z2[1];
+	double z12 = _z1[2], z22 = _z2[2];
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		double x0 = samples0[i], x1 = samples1[i], x2 = samples2[i];
+		double y0 = b00 * x0 + z10;
+		double y1 = b01 * x1 + z11;
+		double y2 = b02 * x2 + z12;
+		z10 = -a10 * y0 + z20;
+		z11 = -a11 * y1 + z21;
+		z12 = -a12 * y2 + z22;
+		z20 = b20 * x0 - a20 * y0;
+		z21 = b21 * x1 - a21 * y1;
+		z22 = b22 * x2 - a22 * y2;
+		samples0[i] = y0;
+		samples1[i] = y1;
+		samples2[i] = y2;
+	}
+
+	_z1[0] = z10;
+	_z2[0] = z20;
+	_z1[1] = z11;
+	_z2[1] = z21;
+	_z1[2] = z12;
+	_z2[2] = z22;
+}
+
+} // namespace KClass